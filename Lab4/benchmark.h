@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Benchmark mode runs every case of a sweep (shapes x element types x modes x rank counts) `warmup` times
+// untimed and `benchmark` times timed, then writes one record per case as JSON, or as CSV when the
+// output file name ends in .csv
+#define BENCHMARK_WARMUP 1
+#define BENCHMARK_OUTPUT "benchmark.json"
+#define BENCHMARK_PERCENTILE 0.95
+
+// one case of the sweep and what it measured: the time of every timed repetition (the slowest rank's)
+// and the bytes the ranks sent each other in one repetition
+struct BenchmarkResult
+{
+	std::string type;
+	std::string ring;
+	std::string mode;
+	int ranks;
+	int threads;
+	int n1;
+	int n2;
+	int n3;
+	// real and float products count as floating point operations, the rest as integer operations
+	bool floating;
+	std::vector<double> seconds;
+	long long bytesMoved;
+};
+
+struct BenchmarkSummary
+{
+	double min;
+	double median;
+	double p95;
+	// 2 * n1 * n2 * n3 operations over the median time, in billions per second
+	double opsPerSecond;
+};
+
+// prototypes
+std::vector<std::string> split_list(const std::string& list);
+bool parse_shape(const std::string& shape, int& n1, int& n2, int& n3);
+BenchmarkSummary summarize_benchmark(const BenchmarkResult& result);
+bool write_benchmark_results(const char* fileName, const std::vector<BenchmarkResult>& results);
+void write_benchmark_json(std::ofstream& fout, const std::vector<BenchmarkResult>& results);
+void write_benchmark_csv(std::ofstream& fout, const std::vector<BenchmarkResult>& results);
+
+// functions
+// "a,b,c" into its items; empty items are dropped
+inline std::vector<std::string> split_list(const std::string& list)
+{
+	std::vector<std::string> items;
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		if (end > start)
+			items.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+	return items;
+}
+
+// "n1xn2xn3", e.g. 512x256x1024
+inline bool parse_shape(const std::string& shape, int& n1, int& n2, int& n3)
+{
+	char rest;
+	return sscanf(shape.c_str(), "%dx%dx%d%c", &n1, &n2, &n3, &rest) == 3 && n1 > 0 && n2 > 0 && n3 > 0;
+}
+
+// the percentile is nearest-rank: the smallest time at least BENCHMARK_PERCENTILE of the repetitions reach
+inline BenchmarkSummary summarize_benchmark(const BenchmarkResult& result)
+{
+	BenchmarkSummary summary = {};
+	std::vector<double> sorted = result.seconds;
+	if (sorted.empty())
+		return summary;
+	std::sort(sorted.begin(), sorted.end());
+
+	size_t count = sorted.size();
+	summary.min = sorted[0];
+	summary.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+	size_t rank = (size_t)(BENCHMARK_PERCENTILE * count + 0.999999);
+	summary.p95 = sorted[std::min(count, std::max(rank, (size_t)1)) - 1];
+	if (summary.median > 0)
+		summary.opsPerSecond = 2.0 * result.n1 * result.n2 * result.n3 / summary.median / 1e9;
+	return summary;
+}
+
+inline bool write_benchmark_results(const char* fileName, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream fout(fileName);
+	if (!fout)
+		return false;
+
+	fout.precision(9);
+	size_t length = strlen(fileName);
+	if (length >= 4 && !strcmp(fileName + length - 4, ".csv"))
+		write_benchmark_csv(fout, results);
+	else
+		write_benchmark_json(fout, results);
+	return (bool)fout;
+}
+
+inline void write_benchmark_json(std::ofstream& fout, const std::vector<BenchmarkResult>& results)
+{
+	fout << "[\n";
+	for (size_t r = 0; r < results.size(); r++)
+	{
+		const BenchmarkResult& result = results[r];
+		BenchmarkSummary summary = summarize_benchmark(result);
+		fout << "  { \"type\": \"" << result.type << "\", \"ring\": \"" << result.ring << "\", \"mode\": \"" << result.mode
+			<< "\", \"ranks\": " << result.ranks << ", \"threads\": " << result.threads
+			<< ", \"n1\": " << result.n1 << ", \"n2\": " << result.n2 << ", \"n3\": " << result.n3
+			<< ", \"repetitions\": " << result.seconds.size()
+			<< ", \"min_s\": " << summary.min << ", \"median_s\": " << summary.median << ", \"p95_s\": " << summary.p95
+			<< ", \"" << (result.floating ? "gflops" : "gops") << "\": " << summary.opsPerSecond
+			<< ", \"bytes_moved\": " << result.bytesMoved << ", \"seconds\": [";
+		for (size_t i = 0; i < result.seconds.size(); i++)
+			fout << (i ? ", " : "") << result.seconds[i];
+		fout << "] }" << (r + 1 < results.size() ? ",\n" : "\n");
+	}
+	fout << "]\n";
+}
+
+// the throughput column holds GFLOP/s for real and float and GOP/s for the rest, as the unit column says
+inline void write_benchmark_csv(std::ofstream& fout, const std::vector<BenchmarkResult>& results)
+{
+	fout << "type,ring,mode,ranks,threads,n1,n2,n3,repetitions,min_s,median_s,p95_s,throughput,unit,bytes_moved\n";
+	for (size_t r = 0; r < results.size(); r++)
+	{
+		const BenchmarkResult& result = results[r];
+		BenchmarkSummary summary = summarize_benchmark(result);
+		fout << result.type << ',' << result.ring << ',' << result.mode << ',' << result.ranks << ',' << result.threads << ','
+			<< result.n1 << ',' << result.n2 << ',' << result.n3 << ',' << result.seconds.size() << ','
+			<< summary.min << ',' << summary.median << ',' << summary.p95 << ',' << summary.opsPerSecond << ','
+			<< (result.floating ? "gflops" : "gops") << ',' << result.bytesMoved << '\n';
+	}
+}
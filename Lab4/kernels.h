@@ -0,0 +1,669 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// msvc emits any intrinsic without extra flags, gcc and clang need the isa enabled per function
+#if defined(KERNELS_X86) && !defined(_MSC_VER)
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_SSE4
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+// cache blocking of the multiply: a KC x NC panel of B stays in L2/L3,
+// an MC x KC panel of A stays in L2 and an MR x NR tile of C stays in registers
+#define BLOCK_MC 96
+#define BLOCK_KC 256
+#define BLOCK_NC 4096
+// the widest micro kernel tile, used to size the tile buffer of the multiply
+#define MAX_MICRO_MR 6
+#define MAX_MICRO_NR 32
+#define ISA_ENV_NAME "LAB4_ISA"
+
+enum Isa { ISA_SCALAR, ISA_SSE4, ISA_AVX2, ISA_AVX512 };
+
+// computes tile (mr x nr, row stride nr) = packed A strip (mr x kc) * packed B strip (kc x nr).
+// Every kernel is a template on the panel depth: KC = 0 reads the depth from kc, while the
+// BLOCK_KC instance, used for all full-depth panels, has a constant trip count the compiler unrolls.
+// The tile may be of a wider type than the elements (see the ring policies in semiring.h)
+template<typename T, typename Accumulator = T>
+struct MicroKernel
+{
+	int mr;
+	int nr;
+	void (*run)(int kc, const T* packedA, const T* packedB, Accumulator* tile);
+	void (*runFullDepth)(int kc, const T* packedA, const T* packedB, Accumulator* tile);
+};
+
+// the type the kernels of T sum products in, which is also the element type of C:
+// int8 and int16 products would overflow their own type at once, so they are summed in int32
+template<typename T>
+struct AccumulatorOf
+{
+	typedef T type;
+};
+
+template<>
+struct AccumulatorOf<int8_t>
+{
+	typedef int type;
+};
+
+template<>
+struct AccumulatorOf<int16_t>
+{
+	typedef int type;
+};
+
+// prototypes
+Isa detect_isa();
+Isa active_isa();
+const char* isa_name(Isa isa);
+
+// template prototypes
+template<typename T>
+const MicroKernel<T, typename AccumulatorOf<T>::type>& active_micro_kernel();
+template<typename T>
+MicroKernel<T, typename AccumulatorOf<T>::type> select_micro_kernel(Isa isa);
+template<typename T, int MR, int NR, int KC>
+void micro_kernel_scalar(int kc, const T* packedA, const T* packedB, typename AccumulatorOf<T>::type* tile);
+template<typename T>
+T wrapping_add(T a, T b);
+template<typename T>
+T wrapping_subtract(T a, T b);
+template<typename T>
+T wrapping_multiply(T a, T b);
+
+// functions
+inline Isa detect_isa()
+{
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false, avx512f = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512f = (info[1] & (1 << 16)) != 0;
+	}
+
+	// the os must save the ymm/zmm state on context switches, otherwise the registers are unusable
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+	if (avx512f && zmmState)
+		return ISA_AVX512;
+	if (avx && avx2 && fma && ymmState)
+		return ISA_AVX2;
+	if (sse41)
+		return ISA_SSE4;
+	return ISA_SCALAR;
+#elif defined(KERNELS_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return ISA_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return ISA_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return ISA_SSE4;
+	return ISA_SCALAR;
+#else
+	return ISA_SCALAR;
+#endif
+}
+
+// the best isa of the node, optionally lowered through the LAB4_ISA environment variable
+// (scalar, sse4, avx2, avx512) to compare kernels or to pin a job to the scalar reference
+inline Isa active_isa()
+{
+	static const Isa isa = []()
+	{
+		Isa detected = detect_isa();
+		const char* requested = getenv(ISA_ENV_NAME);
+		if (requested == nullptr)
+			return detected;
+
+		for (int i = ISA_SCALAR; i <= ISA_AVX512; i++)
+			if (!strcmp(requested, isa_name((Isa)i)))
+				return i < detected ? (Isa)i : detected;
+		return detected;
+	}();
+	return isa;
+}
+
+inline const char* isa_name(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_SSE4:
+		return "sse4";
+	case ISA_AVX2:
+		return "avx2";
+	case ISA_AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
+
+// templates
+// integer sums and products wrap around like the vector kernels' do; C++ only defines that for unsigned
+// types, so integers go through their unsigned type (of at least int's width). Reals add and multiply as usual
+template<typename T>
+T wrapping_add(T a, T b)
+{
+	if constexpr (std::is_integral<T>::value)
+	{
+		typedef typename std::make_unsigned<decltype(a + b)>::type U;
+		return (T)((U)a + (U)b);
+	}
+	else
+		return a + b;
+}
+
+template<typename T>
+T wrapping_subtract(T a, T b)
+{
+	if constexpr (std::is_integral<T>::value)
+	{
+		typedef typename std::make_unsigned<decltype(a - b)>::type U;
+		return (T)((U)a - (U)b);
+	}
+	else
+		return a - b;
+}
+
+template<typename T>
+T wrapping_multiply(T a, T b)
+{
+	if constexpr (std::is_integral<T>::value)
+	{
+		typedef typename std::make_unsigned<decltype(a * b)>::type U;
+		return (T)((U)a * (U)b);
+	}
+	else
+		return a * b;
+}
+
+template<typename T>
+const MicroKernel<T, typename AccumulatorOf<T>::type>& active_micro_kernel()
+{
+	static const MicroKernel<T, typename AccumulatorOf<T>::type> kernel = select_micro_kernel<T>(active_isa());
+	return kernel;
+}
+
+template<typename T, int MR, int NR, int KC>
+void micro_kernel_scalar(int kc, const T* packedA, const T* packedB, typename AccumulatorOf<T>::type* tile)
+{
+	typedef typename AccumulatorOf<T>::type Accumulator;
+	const int depth = KC > 0 ? KC : kc;
+	Accumulator acc[MR][NR] = {};
+
+	for (int k = 0; k < depth; k++, packedA += MR, packedB += NR)
+		for (int i = 0; i < MR; i++)
+		{
+			Accumulator a = packedA[i];
+			for (int j = 0; j < NR; j++)
+				acc[i][j] = wrapping_add(acc[i][j], wrapping_multiply(a, (Accumulator)packedB[j]));
+		}
+
+	for (int i = 0; i < MR; i++)
+		for (int j = 0; j < NR; j++)
+			tile[i * NR + j] = acc[i][j];
+}
+
+template<typename T>
+MicroKernel<T, typename AccumulatorOf<T>::type> select_micro_kernel(Isa isa)
+{
+	return { 4, 8, micro_kernel_scalar<T, 4, 8, 0>, micro_kernel_scalar<T, 4, 8, BLOCK_KC> };
+}
+
+#ifdef KERNELS_X86
+// double kernels: every row of the tile is held in 2 vector registers,
+// each k step broadcasts one element of A per row and loads 2 vectors of B
+
+template<int KC>
+TARGET_SSE4 inline void micro_kernel_sse4(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m128d acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_setzero_pd();
+
+	for (int k = 0; k < depth; k++, packedA += 4, packedB += 4)
+	{
+		__m128d b0 = _mm_loadu_pd(packedB);
+		__m128d b1 = _mm_loadu_pd(packedB + 2);
+		for (int i = 0; i < 4; i++)
+		{
+			__m128d a = _mm_set1_pd(packedA[i]);
+			acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(a, b0));
+			acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_pd(tile + i * 4, acc[i][0]);
+		_mm_storeu_pd(tile + i * 4 + 2, acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX2 inline void micro_kernel_avx2(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256d acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 8)
+	{
+		__m256d b0 = _mm256_loadu_pd(packedB);
+		__m256d b1 = _mm256_loadu_pd(packedB + 4);
+		for (int i = 0; i < 6; i++)
+		{
+			__m256d a = _mm256_broadcast_sd(packedA + i);
+			acc[i][0] = _mm256_fmadd_pd(a, b0, acc[i][0]);
+			acc[i][1] = _mm256_fmadd_pd(a, b1, acc[i][1]);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_pd(tile + i * 8, acc[i][0]);
+		_mm256_storeu_pd(tile + i * 8 + 4, acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX512 inline void micro_kernel_avx512(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m512d acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 16)
+	{
+		__m512d b0 = _mm512_loadu_pd(packedB);
+		__m512d b1 = _mm512_loadu_pd(packedB + 8);
+		for (int i = 0; i < 6; i++)
+		{
+			__m512d a = _mm512_set1_pd(packedA[i]);
+			acc[i][0] = _mm512_fmadd_pd(a, b0, acc[i][0]);
+			acc[i][1] = _mm512_fmadd_pd(a, b1, acc[i][1]);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_pd(tile + i * 16, acc[i][0]);
+		_mm512_storeu_pd(tile + i * 16 + 8, acc[i][1]);
+	}
+}
+
+// int kernels: the low 32 bits of mullo wrap exactly like the scalar int product,
+// so every isa gives the same result as micro_kernel_scalar<int>
+
+template<int KC>
+TARGET_SSE4 inline void micro_kernel_sse4(int kc, const int* packedA, const int* packedB, int* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m128i acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_setzero_si128();
+
+	for (int k = 0; k < depth; k++, packedA += 4, packedB += 8)
+	{
+		__m128i b0 = _mm_loadu_si128((const __m128i*)packedB);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(packedB + 4));
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i a = _mm_set1_epi32(packedA[i]);
+			acc[i][0] = _mm_add_epi32(acc[i][0], _mm_mullo_epi32(a, b0));
+			acc[i][1] = _mm_add_epi32(acc[i][1], _mm_mullo_epi32(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_si128((__m128i*)(tile + i * 8), acc[i][0]);
+		_mm_storeu_si128((__m128i*)(tile + i * 8 + 4), acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX2 inline void micro_kernel_avx2(int kc, const int* packedA, const int* packedB, int* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_si256();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 16)
+	{
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)packedB);
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(packedB + 8));
+		for (int i = 0; i < 6; i++)
+		{
+			__m256i a = _mm256_set1_epi32(packedA[i]);
+			acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_mullo_epi32(a, b0));
+			acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_mullo_epi32(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_si256((__m256i*)(tile + i * 16), acc[i][0]);
+		_mm256_storeu_si256((__m256i*)(tile + i * 16 + 8), acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX512 inline void micro_kernel_avx512(int kc, const int* packedA, const int* packedB, int* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m512i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_setzero_si512();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 32)
+	{
+		__m512i b0 = _mm512_loadu_si512(packedB);
+		__m512i b1 = _mm512_loadu_si512(packedB + 16);
+		for (int i = 0; i < 6; i++)
+		{
+			__m512i a = _mm512_set1_epi32(packedA[i]);
+			acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_mullo_epi32(a, b0));
+			acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_mullo_epi32(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_si512(tile + i * 32, acc[i][0]);
+		_mm512_storeu_si512(tile + i * 32 + 16, acc[i][1]);
+	}
+}
+
+// float kernels: the double kernels with twice the columns per register
+
+template<int KC>
+TARGET_SSE4 inline void micro_kernel_sse4(int kc, const float* packedA, const float* packedB, float* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m128 acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_setzero_ps();
+
+	for (int k = 0; k < depth; k++, packedA += 4, packedB += 8)
+	{
+		__m128 b0 = _mm_loadu_ps(packedB);
+		__m128 b1 = _mm_loadu_ps(packedB + 4);
+		for (int i = 0; i < 4; i++)
+		{
+			__m128 a = _mm_set1_ps(packedA[i]);
+			acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(a, b0));
+			acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_ps(tile + i * 8, acc[i][0]);
+		_mm_storeu_ps(tile + i * 8 + 4, acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX2 inline void micro_kernel_avx2(int kc, const float* packedA, const float* packedB, float* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256 acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 16)
+	{
+		__m256 b0 = _mm256_loadu_ps(packedB);
+		__m256 b1 = _mm256_loadu_ps(packedB + 8);
+		for (int i = 0; i < 6; i++)
+		{
+			__m256 a = _mm256_broadcast_ss(packedA + i);
+			acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+			acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_ps(tile + i * 16, acc[i][0]);
+		_mm256_storeu_ps(tile + i * 16 + 8, acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX512 inline void micro_kernel_avx512(int kc, const float* packedA, const float* packedB, float* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m512 acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 32)
+	{
+		__m512 b0 = _mm512_loadu_ps(packedB);
+		__m512 b1 = _mm512_loadu_ps(packedB + 16);
+		for (int i = 0; i < 6; i++)
+		{
+			__m512 a = _mm512_set1_ps(packedA[i]);
+			acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+			acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_ps(tile + i * 32, acc[i][0]);
+		_mm512_storeu_ps(tile + i * 32 + 16, acc[i][1]);
+	}
+}
+
+// int16 and int8 kernels: two k steps at a time. Interleaving row k and row k + 1 of the B strip puts
+// each column's pair of int16 into one 32-bit lane, and madd_epi16 multiplies it by the pair of A
+// elements and adds both products in int32, twice the products per instruction of mullo_epi32.
+// int8 is widened to int16 as it is loaded. An odd last step is paired with a row of zeros
+
+TARGET_SSE4 inline __m128i load_int16x8(const int16_t* source)
+{
+	return _mm_loadu_si128((const __m128i*)source);
+}
+
+TARGET_SSE4 inline __m128i load_int16x8(const int8_t* source)
+{
+	return _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)source));
+}
+
+TARGET_AVX2 inline __m256i load_int16x16(const int16_t* source)
+{
+	return _mm256_loadu_si256((const __m256i*)source);
+}
+
+TARGET_AVX2 inline __m256i load_int16x16(const int8_t* source)
+{
+	return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)source));
+}
+
+// the pair (a0, a1) as one 32-bit lane, a0 in the low half like the interleaved B rows
+inline int pair_int16(int a0, int a1)
+{
+	return (int)((uint32_t)(uint16_t)a0 | (uint32_t)(uint16_t)a1 << 16);
+}
+
+template<typename T, int KC>
+TARGET_SSE4 inline void micro_kernel_madd_sse4(int kc, const T* packedA, const T* packedB, int* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m128i acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_setzero_si128();
+
+	for (int k = 0; k < depth; k += 2, packedA += 8, packedB += 16)
+	{
+		bool pair = k + 1 < depth;
+		__m128i b0 = load_int16x8(packedB);
+		__m128i b1 = pair ? load_int16x8(packedB + 8) : _mm_setzero_si128();
+		__m128i low = _mm_unpacklo_epi16(b0, b1);
+		__m128i high = _mm_unpackhi_epi16(b0, b1);
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i a = _mm_set1_epi32(pair_int16(packedA[i], pair ? packedA[4 + i] : 0));
+			acc[i][0] = _mm_add_epi32(acc[i][0], _mm_madd_epi16(a, low));
+			acc[i][1] = _mm_add_epi32(acc[i][1], _mm_madd_epi16(a, high));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_si128((__m128i*)(tile + i * 8), acc[i][0]);
+		_mm_storeu_si128((__m128i*)(tile + i * 8 + 4), acc[i][1]);
+	}
+}
+
+// the 256-bit unpacks work within 128-bit lanes, so the accumulators hold columns 0-3, 8-11
+// and 4-7, 12-15 and are put back in order on the way out
+template<typename T, int KC>
+TARGET_AVX2 inline void micro_kernel_madd_avx2(int kc, const T* packedA, const T* packedB, int* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_si256();
+
+	for (int k = 0; k < depth; k += 2, packedA += 12, packedB += 32)
+	{
+		bool pair = k + 1 < depth;
+		__m256i b0 = load_int16x16(packedB);
+		__m256i b1 = pair ? load_int16x16(packedB + 16) : _mm256_setzero_si256();
+		__m256i low = _mm256_unpacklo_epi16(b0, b1);
+		__m256i high = _mm256_unpackhi_epi16(b0, b1);
+		for (int i = 0; i < 6; i++)
+		{
+			__m256i a = _mm256_set1_epi32(pair_int16(packedA[i], pair ? packedA[6 + i] : 0));
+			acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(a, low));
+			acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(a, high));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_si256((__m256i*)(tile + i * 16), _mm256_permute2x128_si256(acc[i][0], acc[i][1], 0x20));
+		_mm256_storeu_si256((__m256i*)(tile + i * 16 + 8), _mm256_permute2x128_si256(acc[i][0], acc[i][1], 0x31));
+	}
+}
+
+template<>
+inline MicroKernel<double> select_micro_kernel<double>(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_AVX512:
+		return { 6, 16, micro_kernel_avx512<0>, micro_kernel_avx512<BLOCK_KC> };
+	case ISA_AVX2:
+		return { 6, 8, micro_kernel_avx2<0>, micro_kernel_avx2<BLOCK_KC> };
+	case ISA_SSE4:
+		return { 4, 4, micro_kernel_sse4<0>, micro_kernel_sse4<BLOCK_KC> };
+	default:
+		return { 4, 8, micro_kernel_scalar<double, 4, 8, 0>, micro_kernel_scalar<double, 4, 8, BLOCK_KC> };
+	}
+}
+
+template<>
+inline MicroKernel<int> select_micro_kernel<int>(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_AVX512:
+		return { 6, 32, micro_kernel_avx512<0>, micro_kernel_avx512<BLOCK_KC> };
+	case ISA_AVX2:
+		return { 6, 16, micro_kernel_avx2<0>, micro_kernel_avx2<BLOCK_KC> };
+	case ISA_SSE4:
+		return { 4, 8, micro_kernel_sse4<0>, micro_kernel_sse4<BLOCK_KC> };
+	default:
+		return { 4, 8, micro_kernel_scalar<int, 4, 8, 0>, micro_kernel_scalar<int, 4, 8, BLOCK_KC> };
+	}
+}
+
+template<>
+inline MicroKernel<float> select_micro_kernel<float>(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_AVX512:
+		return { 6, 32, micro_kernel_avx512<0>, micro_kernel_avx512<BLOCK_KC> };
+	case ISA_AVX2:
+		return { 6, 16, micro_kernel_avx2<0>, micro_kernel_avx2<BLOCK_KC> };
+	case ISA_SSE4:
+		return { 4, 8, micro_kernel_sse4<0>, micro_kernel_sse4<BLOCK_KC> };
+	default:
+		return { 4, 8, micro_kernel_scalar<float, 4, 8, 0>, micro_kernel_scalar<float, 4, 8, BLOCK_KC> };
+	}
+}
+
+// madd_epi16 on zmm registers needs AVX-512BW, which isn't one of the detected levels,
+// so avx512 nodes run the avx2 kernel
+template<>
+inline MicroKernel<int16_t, int> select_micro_kernel<int16_t>(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_AVX512:
+	case ISA_AVX2:
+		return { 6, 16, micro_kernel_madd_avx2<int16_t, 0>, micro_kernel_madd_avx2<int16_t, BLOCK_KC> };
+	case ISA_SSE4:
+		return { 4, 8, micro_kernel_madd_sse4<int16_t, 0>, micro_kernel_madd_sse4<int16_t, BLOCK_KC> };
+	default:
+		return { 4, 8, micro_kernel_scalar<int16_t, 4, 8, 0>, micro_kernel_scalar<int16_t, 4, 8, BLOCK_KC> };
+	}
+}
+
+template<>
+inline MicroKernel<int8_t, int> select_micro_kernel<int8_t>(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_AVX512:
+	case ISA_AVX2:
+		return { 6, 16, micro_kernel_madd_avx2<int8_t, 0>, micro_kernel_madd_avx2<int8_t, BLOCK_KC> };
+	case ISA_SSE4:
+		return { 4, 8, micro_kernel_madd_sse4<int8_t, 0>, micro_kernel_madd_sse4<int8_t, BLOCK_KC> };
+	default:
+		return { 4, 8, micro_kernel_scalar<int8_t, 4, 8, 0>, micro_kernel_scalar<int8_t, 4, 8, BLOCK_KC> };
+	}
+}
+#endif
@@ -2,665 +2,2618 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
-#include <typeinfo>
 #include <chrono>
 #include<utility>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <future>
+#include <filesystem>
+#include "kernels.h"
+#include "matrix.h"
+#include "matrix_format.h"
+#include "semiring.h"
+#include "text_format.h"
+#include "thread_pool.h"
+#include "benchmark.h"
+#include "trace.h"
+#include "operand_cache.h"
+#include "sparse.h"
+#include "narrow.h"
+#include "stream.h"
+#include "verify.h"
 
 using namespace std;
 
-#define N1 960
-#define N2 768
-#define N3 160
 #define SETTINGS_FILE_NAME "appsettings.txt"
 #define MAX_NAME_LENGTH 100
 #define SETTINGS_COUNT 5
+// message tags: the B blocks passed around the ring, the A and B blocks shifted across the Cannon grid,
+// the C blocks collected by the first rank of each grid row, the packed sparse and bit packed narrow B blocks
+// of the ring and the C row blocks gathered on rank 0
+#define TAG_RING 2
+#define TAG_SHIFT_A 3
+#define TAG_SHIFT_B 4
+#define TAG_GRID_GATHER 5
+#define TAG_RING_SPARSE 6
+#define TAG_RING_NARROW 7
+#define TAG_ROW_GATHER 8
+// with automatic tiles the columns of C are cut until every thread has about this many tiles to share
+#define TILES_PER_THREAD 4
+// Strassen-Winograd recurses while every dimension of the product is above this
+#define STRASSEN_CUTOFF 512
+// server mode: how long rank 0 waits before looking at an empty spool directory again, and the other ranks before
+// testing again whether its broadcast has come, and what next_spool_job finds in the directory
+#define SPOOL_POLL_MS 2
+#define SERVE_IDLE 0
+#define SERVE_JOB 1
+#define SERVE_STOP 2
+
+// one line "type A B C" of the batch manifest; the dimensions come from the files of A and B
+struct BatchJob
+{
+	string type;
+	string fileNames[3];
+	int n1 = 0;
+	int n2 = 0;
+	int n3 = 0;
+};
+
+// a job of server mode as rank 0 broadcasts it, dimensions resolved
+struct JobDescriptor
+{
+	int command;
+	int n1;
+	int n2;
+	int n3;
+	char type[MAX_NAME_LENGTH];
+	char fileNames[3][MAX_NAME_LENGTH];
+};
+
+// appsettings.txt holds SETTINGS_COUNT positional values (element type, files of A, B and C, mode)
+// followed by optional "key value" pairs. The element type is int, real (double), float, int64, int16
+// or int8 (int16 and int8 products are summed into an int32 C). The mode is sync (one process),
+// cannon or summa (a 2D process grid), stream (tile by tile from the files, for matrices larger than memory)
+// or anything else for the 1D ring
+struct Settings
+{
+	Matrix<char> fileNames;
+	// A is n1 x n2, B is n2 x n3; 0 means the dimension is taken from the matrix files
+	int n1 = 0;
+	int n2 = 0;
+	int n3 = 0;
+	// ring: post the exchange of the next B block before multiplying the current one
+	bool pipeline = true;
+	// ring: gather C on rank 0 and write it there; 0 makes every rank write its own rows of the file
+	bool gather = true;
+	// threads multiplying in each process; 0 means one per hardware thread,
+	// -1 all hardware threads in sync mode and one thread per rank in the ring
+	int threads = -1;
+	// rows and columns of the tiles of C the threads share (rounded up to whole micro tiles); 0 is automatic
+	int tileRows = 0;
+	int tileCols = 0;
+	// Strassen-Winograd for the sync multiply and the ring blocks: 1 on, 0 off, -1 on for the exact rings
+	// (int, modp, wrap64), while for real it trades some accuracy for the speed. Tropical rings never use it
+	int strassen = -1;
+	int strassenCutoff = STRASSEN_CUTOFF;
+	// what the multiply adds and multiplies with: plus-times (int or real, by the element type),
+	// modp (int residues modulo `modulus`), wrap64 (64-bit integers modulo 2^64), min-plus or max-plus (real)
+	string ring = RING_PLUS_TIMES;
+	long long modulus = DEFAULT_MODULUS;
+	// benchmark mode: timed repetitions of every case (0 runs the multiply once and writes C) after
+	// `warmup` untimed ones. The sweep lists are comma separated, an empty list keeps the settings above:
+	// shapes as n1xn2xn3, element types or rings, modes and rank counts
+	int benchmark = 0;
+	int warmup = BENCHMARK_WARMUP;
+	string benchShapes;
+	string benchTypes;
+	string benchModes;
+	string benchRanks;
+	string benchOutput = BENCHMARK_OUTPUT;
+	// Chrome trace of the phases of every rank; empty means no tracing
+	string trace;
+	// manifest of the jobs of batch mode (one MPI session for all of them); empty means a single product.
+	// batchJobs are the consecutive jobs of one element type that a run of the ring works through
+	string batch;
+	vector<BatchJob> batchJobs;
+	// spool directory of server mode (the ranks stay up and take jobs from it); empty means no server.
+	// The batch and the server keep up to cacheMegabytes of operand slabs per rank, of all element types together, for later jobs
+	string serve;
+	int cacheMegabytes = OPERAND_CACHE_MB;
+	// the sync multiply and the ring multiply an operand (the A rows or a B block) in packed sparse form when
+	// at most this share of its elements is kept; a negative value keeps everything dense
+	double sparseThreshold = SPARSE_THRESHOLD;
+	// the ring sends a B block and the gather a C row block bit packed when they hold whole numbers in a range so
+	// narrow that the packed form takes at most this share (up to 1) of the dense bytes; a negative value sends everything dense
+	double narrowRatio = NARROW_RATIO;
+	// stream: megabytes of tiles each rank keeps in memory (the operands and results it works on and the ones
+	// being read and written)
+	int memoryMegabytes = STREAM_MEMORY_MB;
+	// Freivalds' check of C with this many random vectors after the multiply of sync, the ring, cannon and summa;
+	// 0 skips it, and load_settings turns it off for batch, server and stream modes, which never hold the operands and
+	// C of a product together. verifyTolerance bounds the relative error the real rings allow, 0 takes it from n2 and
+	// the type of C (and the levels of Strassen)
+	int verify = 0;
+	double verifyTolerance = 0;
+};
+
+// what a run measured for the benchmark: the time of every timed repetition (the slowest rank's)
+// and the bytes the ranks sent each other in one repetition
+struct RunReport
+{
+	vector<double> seconds;
+	long long bytesMoved = 0;
+	// why this rank couldn't read an operand (or, in batch and server, write C of a job), empty when it could
+	string error;
+};
 
 // template prototypes
+template<typename Ring, typename T>
+void matrix_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, ThreadPool& pool, int tileRows, int tileCols);
+template<typename Ring, typename T>
+void part_of_matrix_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW, ThreadPool& pool, int tileRows, int tileCols);
+template<typename Ring, typename T>
+void part_of_matrix_multiply_add(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW, ThreadPool& pool, int tileRows, int tileCols);
+template<typename Ring, typename T>
+void multiply_tile(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW);
+template<typename Ring>
+bool strassen_enabled(const Settings& settings);
 template<typename T>
-T** create_matrix(int height, int width);
+size_t strassen_workspace_size(int n1, int n2, int n3, int cutoff);
+template<typename Ring, typename T>
+void strassen_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<T>& C, int n1, int n2, int n3, int cutoff, T* workspace, ThreadPool& pool, int tileRows, int tileCols);
+template<typename Ring, typename T>
+void multiply_block(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, bool strassen, T* workspace, const Settings& settings, ThreadPool& pool);
+template<typename Ring, typename T>
+void multiply_operands(const Matrix<T>& A, const char* sparseA, const Matrix<T>& B, const char* sparseB, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, bool strassen, T* workspace, const Settings& settings, ThreadPool& pool);
+template<typename Ring, typename T>
+void matrix_add(const Matrix<T>& X, const Matrix<T>& Y, Matrix<T>& Z, int height, int width, int sign, ThreadPool& pool);
 template<typename T>
-void delete_matrix(T **&matrix, int height);
+void pack_block_a(const Matrix<T>& A, T* packedA, int startH, int startW, int mc, int kc, int mr);
 template<typename T>
-void matrix_multiply(T** A, T** B, T** C, int n1, int n2, int n3);
+void pack_block_b(const Matrix<T>& B, T* packedB, int startH, int startW, int kc, int nc, int nr);
 template<typename T>
-void part_of_matrix_multiply(T** A, T** B, T** C, int n1, int n2, int n3, int cStartH, int cStartW);
+bool read_matrix_from_file(const char* fileName, Matrix<T>& matrix, int height, int width);
 template<typename T>
-void read_matrix_from_file(const char* fileName, T** matrix, int height, int width);
+bool read_part_of_matrix_from_file(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
 template<typename T>
-void read_part_of_matrix_from_file(const char* fileName, T** matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
+bool read_part_of_matrix_collective(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW, MPI_Comm comm);
 template<typename T>
-void print_matrix_to_file(const char* fileName, T** matrix, int height, int width);
+bool read_part_of_matrix_cached(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
 template<typename T>
-void move_chunk_to_matrix(T** C, T** Ctemp, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
+bool print_matrix_to_file(const char* fileName, const Matrix<T>& matrix, int height, int width);
 template<typename T>
-void run_process_sync(char** fileNames);
+bool print_part_of_matrix_collective(const char* fileName, const Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, MPI_Comm comm);
+template<typename Ring>
+void run_process_sync(const Settings& settings, RunReport& report);
+template<typename Ring>
+void run_process_ring(const Settings& settings, MPI_Comm comm, RunReport& report);
+template<typename Ring>
+void run_process_cannon(const Settings& settings, MPI_Comm comm, RunReport& report);
+template<typename Ring>
+void run_process_summa(const Settings& settings, MPI_Comm comm, RunReport& report);
+template<typename Ring>
+void run_process_stream(const Settings& settings, MPI_Comm comm, RunReport& report);
+template<typename Ring>
+void run_process(const Settings& settings, bool isSync, MPI_Comm comm, RunReport& report);
+template<typename Ring, typename T>
+long long ring_pass(const Settings& settings, MPI_Comm comm, const Matrix<T>& A, const char* sparseA, Matrix<T>& B, Matrix<T>& Bnext, int& formB, int& bytesB, Matrix<typename Ring::Result>& C, int firstBlock, int n2, int n3, bool strassen, T* workspace, ThreadPool& pool);
+template<typename Ring, typename T>
+void pack_ring_block(const Settings& settings, const Matrix<T>& ownB, int& form, int& bytes);
+template<typename Ring>
+void run_batch_ring(const Settings& settings, MPI_Comm comm, RunReport& report);
+template<typename Ring, typename T>
+void normalize_matrix(Matrix<T>& matrix);
 template<typename T>
-void run_process_0(char** fileNames);
+bool load_operand(const Settings& settings, int operand, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW, MPI_Comm comm);
 template<typename T>
-void run_process_1(char** fileNames);
+void load_operand_tile(const Settings& settings, int operand, const TextMatrixFile& text, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
 template<typename T>
-void run_process_2(char** fileNames);
+void synthesize_operand(int operand, Matrix<T>& matrix, int startIndexH, int endIndexH, int startIndexW, int endIndexW);
 template<typename T>
-void run_process_3(char** fileNames);
+bool convert_stream_result(const char* binaryName, const char* textName, int height, int width, size_t budget);
 template<typename T>
-void run_process_4(char** fileNames);
+MPI_Datatype mpi_type_of();
 template<typename T>
-void run_process_5(char** fileNames);
+void write_row_blocks(const Settings& settings, Matrix<T>& C, int n1, int n3, int rowStart, int rows, MPI_Comm comm, ThreadPool& pool);
 template<typename T>
-void run_process_6(char** fileNames);
+void write_grid_blocks(const Settings& settings, Matrix<T>& result, int n1, int n3, int rowStart, int rows, const int dims[2], const int coords[2], MPI_Comm rowComm, MPI_Comm colComm, ThreadPool& pool);
 template<typename T>
-void run_process_7(char** fileNames);
+void gather_row_blocks(const Settings& settings, Matrix<T>& C, int n1, int n3, int rows, MPI_Comm comm, ThreadPool& pool);
+template<typename Ring, typename T>
+void verify_product(const Settings& settings, const Matrix<T>& A, int aColStart, int aCols, const Matrix<T>& B, const char* sparseB, int bRowStart, int bRows, int bColStart, int bCols, const Matrix<typename Ring::Result>& C, int cColStart, int cCols, int rows, MPI_Comm comm, MPI_Comm rowComm, ThreadPool& pool);
 
 // prototypes
-char** load_settings();
+Settings load_settings();
+void run_process_in_ring(const Settings& settings, bool isSync, MPI_Comm comm, RunReport& report);
+bool is_ring_name(const string& name);
+void run_benchmark(Settings& settings);
+int repetition_count(const Settings& settings);
+void record_repetition(const Settings& settings, RunReport& report, int repetition, long long nanoseconds, MPI_Comm comm);
+void run_batch(Settings& settings);
+bool read_batch_manifest(const char* fileName, vector<BatchJob>& jobs);
+bool serve(Settings& settings);
+JobDescriptor next_spool_job(const string& directory, string& jobName);
+void finish_spool_job(const string& directory, const string& jobName, const string& result);
+void start_trace(const Settings& settings, MPI_Comm comm);
+void finish_trace(const Settings& settings, MPI_Comm comm);
+MPI_Datatype mpi_type_of_element(uint32_t elementType);
+bool resolve_dimensions(Settings& settings);
+void read_matrix_dimensions(const char* fileName, int& height, int& width);
+int block_start(int index, int n, int count);
+int block_size(int index, int n, int count);
+int block_index(int k, int n, int count);
+bool create_grid(MPI_Comm comm, int dims[2], int coords[2], MPI_Comm& grid, MPI_Comm& rowComm, MPI_Comm& colComm);
+MPI_Op mpi_op_of(VerifyReduction reduction);
 void print_time(int procRank, long long nanoseconds, bool isSync);
 
-int main(int *argc, char **argv)
+int main(int argc, char **argv)
 {
-	char **fileNames = load_settings();
+	Settings settings = load_settings();
 
-	bool isReal = !strcmp(fileNames[0], "real");
-	bool isSync = !strcmp(fileNames[4], "sync");
+	bool isSync = !strcmp(settings.fileNames[4], "sync");
+	int failed = 0;
 	
-	if (isSync) 
+	if (isSync && settings.benchmark == 0 && settings.batch.empty() && settings.serve.empty()) 
 	{
-		if (isReal)
-			run_process_sync<double>(fileNames);
-		else
-			run_process_sync<int>(fileNames);
+		if (!resolve_dimensions(settings))
+			return 1;
+
+		start_trace(settings, MPI_COMM_NULL);
+		RunReport report;
+		run_process_in_ring(settings, true, MPI_COMM_NULL, report);
+		failed = !report.error.empty();
+		finish_trace(settings, MPI_COMM_NULL);
 	}
 	else 
 	{
-		int ProcNum, ProcRank = 0;
-		MPI_Init(argc, &argv);
-		MPI_Comm_size(MPI_COMM_WORLD, &ProcNum);
-		MPI_Comm_rank(MPI_COMM_WORLD, &ProcRank);
+		// the worker threads of a rank never call MPI themselves
+		int provided;
+		MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+		if (provided < MPI_THREAD_FUNNELED)
+		{
+			if (settings.threads >= 0 && settings.threads != 1)
+				cout << "The MPI library doesn't support threads, running one thread per process." << endl;
+			settings.threads = 1;
+		}
 
-		switch (ProcRank)
+		// rank 0 scans the files for missing dimensions and shares the result; dims[3] flags a failure.
+		// A benchmark sweeping its own shapes needs no files, a batch or a server takes the dimensions of every job itself
+		int procRank, dims[4];
+		MPI_Comm_rank(MPI_COMM_WORLD, &procRank);
+		if (procRank == 0)
 		{
-		case 0:
-			if (isReal)
-				run_process_0<double>(fileNames);
-			else
-				run_process_0<int>(fileNames);
-			break;
-		case 1:
-			if (isReal)
-				run_process_1<double>(fileNames);
-			else
-				run_process_1<int>(fileNames);
-			break;
-		case 2:
-			if (isReal)
-				run_process_2<double>(fileNames);
-			else
-				run_process_2<int>(fileNames);
-			break;
-		case 3:
-			if (isReal)
-				run_process_3<double>(fileNames);
-			else
-				run_process_3<int>(fileNames);
-			break;
-		case 4:
-			if (isReal)
-				run_process_4<double>(fileNames);
-			else
-				run_process_4<int>(fileNames);
-			break;
-		case 5:
-			if (isReal)
-				run_process_5<double>(fileNames);
-			else
-				run_process_5<int>(fileNames);
-			break;
-		case 6:
-			if (isReal)
-				run_process_6<double>(fileNames);
-			else
-				run_process_6<int>(fileNames);
-			break;
-		case 7:
-			if (isReal)
-				run_process_7<double>(fileNames);
-			else
-				run_process_7<int>(fileNames);
-			break;
-		default:
-			break;
+			dims[3] = (settings.benchmark > 0 && !settings.benchShapes.empty()) || !settings.batch.empty() || !settings.serve.empty() ? 1 : resolve_dimensions(settings);
+			dims[0] = settings.n1;
+			dims[1] = settings.n2;
+			dims[2] = settings.n3;
 		}
+		MPI_Bcast(dims, 4, MPI_INT, 0, MPI_COMM_WORLD);
+		if (!dims[3])
+		{
+			MPI_Finalize();
+			return 1;
+		}
+		settings.n1 = dims[0];
+		settings.n2 = dims[1];
+		settings.n3 = dims[2];
+
+		start_trace(settings, MPI_COMM_WORLD);
+		if (!settings.serve.empty())
+			failed = !serve(settings);
+		else if (!settings.batch.empty())
+			run_batch(settings);
+		else if (settings.benchmark > 0)
+			run_benchmark(settings);
+		else
+		{
+			RunReport report;
+			run_process_in_ring(settings, false, MPI_COMM_WORLD, report);
+			// ranks outside a grid read nothing, so every rank exits with the outcome of the run
+			failed = !report.error.empty();
+			MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+		}
+		finish_trace(settings, MPI_COMM_WORLD);
 
 		MPI_Finalize();
 	}
-	
-	delete_matrix(fileNames, SETTINGS_COUNT);
 
-	return 0;
+	return failed ? 1 : 0;
 }
 
 // templates
-template<typename T>
-T** create_matrix(int height, int width)
+template<typename Ring>
+void run_process(const Settings& settings, bool isSync, MPI_Comm comm, RunReport& report)
+{
+	if (!settings.batchJobs.empty())
+		run_batch_ring<Ring>(settings, comm, report);
+	else if (isSync)
+		run_process_sync<Ring>(settings, report);
+	else if (!strcmp(settings.fileNames[4], "cannon"))
+		run_process_cannon<Ring>(settings, comm, report);
+	else if (!strcmp(settings.fileNames[4], "summa"))
+		run_process_summa<Ring>(settings, comm, report);
+	else if (!strcmp(settings.fileNames[4], "stream"))
+		run_process_stream<Ring>(settings, comm, report);
+	else
+		run_process_ring<Ring>(settings, comm, report);
+}
+
+template<typename Ring, typename T>
+void matrix_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, ThreadPool& pool, int tileRows, int tileCols)
+{
+	part_of_matrix_multiply<Ring>(A, B, C, n1, n2, n3, 0, 0, pool, tileRows, tileCols);
+}
+
+template<typename Ring, typename T>
+void part_of_matrix_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW, ThreadPool& pool, int tileRows, int tileCols)
 {
-	T** matrix = new T * [height];
-	for (int i = 0; i < height; i++)
+	C.view(cStartH, cStartW, n1, n3).fill(Ring::zero());
+	part_of_matrix_multiply_add<Ring>(A, B, C, n1, n2, n3, cStartH, cStartW, pool, tileRows, tileCols);
+}
+
+// adds A * B to the n1 x n3 block of C at (cStartH, cStartW)
+template<typename Ring, typename T>
+void part_of_matrix_multiply_add(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW, ThreadPool& pool, int tileRows, int tileCols)
+{
+	if (n1 <= 0 || n3 <= 0)
+		return;
+
+	// the threads share tiles of C made of whole micro tiles. Automatic tiles are BLOCK_MC rows high and
+	// span all columns, unless that leaves the threads fewer than TILES_PER_THREAD tiles each
+	const auto& kernel = Ring::kernel();
+	tileRows = tileRows > 0 ? (tileRows + kernel.mr - 1) / kernel.mr * kernel.mr : BLOCK_MC;
+	int rowTiles = (n1 + tileRows - 1) / tileRows;
+	if (tileCols <= 0)
 	{
-		matrix[i] = new T[width];
-		for (int j = 0; j < width; j++)
-			matrix[i][j] = 0;
+		int colTiles = 1;
+		if (pool.size() > 1 && rowTiles < TILES_PER_THREAD * pool.size())
+			colTiles = min((TILES_PER_THREAD * pool.size() + rowTiles - 1) / rowTiles, (n3 + kernel.nr - 1) / kernel.nr);
+		tileCols = (n3 + colTiles - 1) / colTiles;
 	}
-	return matrix;
+	tileCols = (tileCols + kernel.nr - 1) / kernel.nr * kernel.nr;
+	int colTiles = (n3 + tileCols - 1) / tileCols;
+
+	pool.parallel_for(rowTiles * colTiles, [&](int tile)
+	{
+		int startH = tile / colTiles * tileRows, startW = tile % colTiles * tileCols;
+		int height = min(tileRows, n1 - startH), width = min(tileCols, n3 - startW);
+		Matrix<typename Ring::Result> tileC = C.view(cStartH + startH, cStartW + startW, height, width);
+		multiply_tile<Ring>(A.view(startH, 0, height, n2), B.view(0, startW, n2, width), tileC, height, n2, width, 0, 0);
+	});
 }
 
+template<typename Ring>
+bool strassen_enabled(const Settings& settings)
+{
+	return Ring::supportsStrassen && (settings.strassen > 0 || (settings.strassen < 0 && Ring::exact));
+}
+
+// elements of workspace strassen_multiply needs for an n1 x n2 by n2 x n3 product
 template<typename T>
-T** create_allocated_matrix(int height, int width) {
-	T* data = new T[height * width];
+size_t strassen_workspace_size(int n1, int n2, int n3, int cutoff)
+{
+	if (min(n1, min(n2, n3)) <= cutoff)
+		return 0;
+
+	size_t alignment = MATRIX_ALIGNMENT / sizeof(T);
+	int m = n1 / 2, k = n2 / 2, n = n3 / 2;
+	size_t level = ((size_t)m * k + alignment - 1) / alignment * alignment
+		+ ((size_t)k * n + alignment - 1) / alignment * alignment
+		+ ((size_t)m * n + alignment - 1) / alignment * alignment;
+	return level + strassen_workspace_size<T>(m, k, n, cutoff);
+}
 
-	for (int i = 0; i < height * width; i++)
-		data[i] = 0;
+// C = A * B by Strassen-Winograd: 7 half-size products and 15 additions a level instead of 8 products.
+// An odd row, column or inner index is peeled off and done by the blocked kernel, as is every product
+// with a dimension at most cutoff. A level keeps one sum of A quadrants, one sum of B quadrants and one
+// product at the front of workspace and the deeper levels use the rest (strassen_workspace_size elements).
+// The products go straight into the C quadrants where the schedule allows
+template<typename Ring, typename T>
+void strassen_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<T>& C, int n1, int n2, int n3, int cutoff, T* workspace, ThreadPool& pool, int tileRows, int tileCols)
+{
+	if (min(n1, min(n2, n3)) <= cutoff)
+	{
+		part_of_matrix_multiply<Ring>(A, B, C, n1, n2, n3, 0, 0, pool, tileRows, tileCols);
+		return;
+	}
 
-	T** array = new T*[height];
+	size_t alignment = MATRIX_ALIGNMENT / sizeof(T);
+	int m = n1 / 2, k = n2 / 2, n = n3 / 2;
+	Matrix<T> A11 = A.view(0, 0, m, k), A12 = A.view(0, k, m, k), A21 = A.view(m, 0, m, k), A22 = A.view(m, k, m, k);
+	Matrix<T> B11 = B.view(0, 0, k, n), B12 = B.view(0, n, k, n), B21 = B.view(k, 0, k, n), B22 = B.view(k, n, k, n);
+	Matrix<T> C11 = C.view(0, 0, m, n), C12 = C.view(0, n, m, n), C21 = C.view(m, 0, m, n), C22 = C.view(m, n, m, n);
+
+	Matrix<T> sumA(workspace, m, k, k);
+	workspace += ((size_t)m * k + alignment - 1) / alignment * alignment;
+	Matrix<T> sumB(workspace, k, n, n);
+	workspace += ((size_t)k * n + alignment - 1) / alignment * alignment;
+	Matrix<T> product(workspace, m, n, n);
+	workspace += ((size_t)m * n + alignment - 1) / alignment * alignment;
+
+	strassen_multiply<Ring>(A11, B11, product, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P1
+	strassen_multiply<Ring>(A12, B21, C11, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P2
+	matrix_add<Ring>(C11, product, C11, m, n, 1, pool);	// C11 = P1 + P2
+
+	matrix_add<Ring>(A21, A22, sumA, m, k, 1, pool);	// S1
+	matrix_add<Ring>(sumA, A11, sumA, m, k, -1, pool);	// S2 = S1 - A11
+	matrix_add<Ring>(B12, B11, sumB, k, n, -1, pool);	// T1
+	matrix_add<Ring>(B22, sumB, sumB, k, n, -1, pool);	// T2 = B22 - T1
+	strassen_multiply<Ring>(sumA, sumB, C22, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P6
+	matrix_add<Ring>(C22, product, C22, m, n, 1, pool);	// U2 = P1 + P6
+
+	matrix_add<Ring>(A11, A21, sumA, m, k, -1, pool);	// S3
+	matrix_add<Ring>(B22, B12, sumB, k, n, -1, pool);	// T3
+	strassen_multiply<Ring>(sumA, sumB, product, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P7
+	matrix_add<Ring>(C22, product, C21, m, n, 1, pool);	// U3 = U2 + P7
+
+	matrix_add<Ring>(A21, A22, sumA, m, k, 1, pool);	// S1
+	matrix_add<Ring>(B12, B11, sumB, k, n, -1, pool);	// T1
+	strassen_multiply<Ring>(sumA, sumB, product, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P5
+	matrix_add<Ring>(C22, product, C12, m, n, 1, pool);	// U4 = U2 + P5
+	matrix_add<Ring>(C21, product, C22, m, n, 1, pool);	// C22 = U3 + P5
+
+	matrix_add<Ring>(sumA, A11, sumA, m, k, -1, pool);	// S2 = S1 - A11
+	matrix_add<Ring>(A12, sumA, sumA, m, k, -1, pool);	// S4 = A12 - S2
+	strassen_multiply<Ring>(sumA, B22, product, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P3
+	matrix_add<Ring>(C12, product, C12, m, n, 1, pool);	// C12 = U4 + P3
+
+	matrix_add<Ring>(B22, sumB, sumB, k, n, -1, pool);	// T2 = B22 - T1
+	matrix_add<Ring>(sumB, B21, sumB, k, n, -1, pool);	// T4 = T2 - B21
+	strassen_multiply<Ring>(A22, sumB, product, m, k, n, cutoff, workspace, pool, tileRows, tileCols);	// P4
+	matrix_add<Ring>(C21, product, C21, m, n, -1, pool);	// C21 = U3 - P4
+
+	Matrix<T> evenC = C.view(0, 0, 2 * m, 2 * n);
+	if (n2 % 2)
+		part_of_matrix_multiply_add<Ring>(A.view(0, 2 * k, 2 * m, 1), B.view(2 * k, 0, 1, 2 * n), evenC, 2 * m, 1, 2 * n, 0, 0, pool, tileRows, tileCols);
+	if (n3 % 2)
+		part_of_matrix_multiply<Ring>(A, B.view(0, 2 * n, n2, 1), C, n1, n2, 1, 0, 2 * n, pool, tileRows, tileCols);
+	if (n1 % 2)
+		part_of_matrix_multiply<Ring>(A.view(2 * m, 0, 1, n2), B, C, 1, n2, 2 * n, 2 * m, 0, pool, tileRows, tileCols);
+}
 
-	for (int i = 0; i < height; i++)
-		array[i] = &(data[width * i]);
+// C = A * B by Strassen-Winograd when strassen is set, else by the tiled kernel.
+// Only rings whose C holds the same type as A and B get the Strassen code compiled in
+template<typename Ring, typename T>
+void multiply_block(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, bool strassen, T* workspace, const Settings& settings, ThreadPool& pool)
+{
+	if constexpr (Ring::supportsStrassen)
+		if (strassen)
+		{
+			strassen_multiply<Ring>(A, B, C, n1, n2, n3, settings.strassenCutoff, workspace, pool, settings.tileRows, settings.tileCols);
+			return;
+		}
+	matrix_multiply<Ring>(A, B, C, n1, n2, n3, pool, settings.tileRows, settings.tileCols);
+}
 
-	return array;
+// C = A * B where either operand may be packed sparse instead (sparseA or sparseB not null)
+template<typename Ring, typename T>
+void multiply_operands(const Matrix<T>& A, const char* sparseA, const Matrix<T>& B, const char* sparseB, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, bool strassen, T* workspace, const Settings& settings, ThreadPool& pool)
+{
+	if (sparseA && sparseB)
+		sparse_sparse_multiply<Ring>(sparse_view<T>(sparseA), sparse_view<T>(sparseB), C, pool);
+	else if (sparseA)
+		sparse_dense_multiply<Ring>(sparse_view<T>(sparseA), B, C, n3, pool);
+	else if (sparseB)
+		dense_sparse_multiply<Ring>(A, sparse_view<T>(sparseB), C, n1, n2, pool);
+	else
+		multiply_block<Ring>(A, B, C, n1, n2, n3, strassen, workspace, settings, pool);
 }
 
-template<typename T>
-void delete_matrix(T** &matrix, int height)
+// Z = X + sign * Y, element by element in the ring, so Z may be X or Y
+template<typename Ring, typename T>
+void matrix_add(const Matrix<T>& X, const Matrix<T>& Y, Matrix<T>& Z, int height, int width, int sign, ThreadPool& pool)
 {
-	for (int i = 0; i < height; i++)
-		delete[] matrix[i];
-	delete[] matrix;
+	pool.parallel_for((height + BLOCK_MC - 1) / BLOCK_MC, [&](int task)
+	{
+		for (int i = task * BLOCK_MC; i < min(height, (task + 1) * BLOCK_MC); i++)
+		{
+			const T* xRow = X[i];
+			const T* yRow = Y[i];
+			T* zRow = Z[i];
+			if (sign > 0)
+				for (int j = 0; j < width; j++)
+					zRow[j] = Ring::add(xRow[j], yRow[j]);
+			else
+				for (int j = 0; j < width; j++)
+					zRow[j] = Ring::subtract(xRow[j], yRow[j]);
+		}
+	});
 }
 
-template<typename T>
-void delete_allocated_matrix(T** matrix, int height) {
-	delete[] matrix[0];
-	delete[] matrix;
+// adds A * B to the n1 x n3 block of C at (cStartH, cStartW) on the calling thread.
+// The micro kernel sums in the accumulator type of the ring and the tile is folded into C once per panel
+template<typename Ring, typename T>
+void multiply_tile(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, int n3, int cStartH, int cStartW)
+{
+	typedef typename Ring::Accumulator Accumulator;
+	const auto& kernel = Ring::kernel();
+	int maxMc = min(BLOCK_MC, n1), maxKc = min(BLOCK_KC, n2), maxNc = min(BLOCK_NC, n3);
+
+	// the packed panels are reused by every call on the thread and only grow
+	static thread_local Matrix<T> packedA, packedB;
+	if (packedA.size() < (size_t)(maxMc + kernel.mr) * maxKc)
+		packedA = Matrix<T>(1, (maxMc + kernel.mr) * maxKc);
+	if (packedB.size() < (size_t)(maxNc + kernel.nr) * maxKc)
+		packedB = Matrix<T>(1, (maxNc + kernel.nr) * maxKc);
+	alignas(MATRIX_ALIGNMENT) Accumulator tile[MAX_MICRO_MR * MAX_MICRO_NR];
+
+	for (int jc = 0; jc < n3; jc += BLOCK_NC)
+	{
+		int nc = min(BLOCK_NC, n3 - jc);
+		for (int pc = 0; pc < n2; pc += BLOCK_KC)
+		{
+			int kc = min(BLOCK_KC, n2 - pc);
+			pack_block_b(B, packedB.data(), pc, jc, kc, nc, kernel.nr);
+
+			for (int ic = 0; ic < n1; ic += BLOCK_MC)
+			{
+				int mc = min(BLOCK_MC, n1 - ic);
+				pack_block_a(A, packedA.data(), ic, pc, mc, kc, kernel.mr);
+
+				for (int jr = 0; jr < nc; jr += kernel.nr)
+				{
+					int nr = min(kernel.nr, nc - jr);
+					for (int ir = 0; ir < mc; ir += kernel.mr)
+					{
+						int mr = min(kernel.mr, mc - ir);
+						(kc == BLOCK_KC ? kernel.runFullDepth : kernel.run)(kc, packedA.data() + (size_t)ir * kc, packedB.data() + (size_t)jr * kc, tile);
+
+						for (int i = 0; i < mr; i++)
+						{
+							typename Ring::Result* cRow = C[cStartH + ic + ir + i] + cStartW + jc + jr;
+							for (int j = 0; j < nr; j++)
+								cRow[j] = Ring::accumulate(cRow[j], tile[i * kernel.nr + j]);
+						}
+					}
+				}
+			}
+		}
+	}
 }
 
+// copies A[startH..startH+mc)[startW..startW+kc) into MR-row strips, k-major inside a strip,
+// so the micro kernel reads A sequentially; the last strip is padded with zeros
 template<typename T>
-void matrix_multiply(T** A, T** B, T** C, int n1, int n2, int n3)
+void pack_block_a(const Matrix<T>& A, T* packedA, int startH, int startW, int mc, int kc, int mr)
 {
-	for(int i = 0; i < n1; i++)
-		for (int j = 0; j < n3; j++) 
+	for (int i = 0; i < mc; i += mr)
+	{
+		int rows = min(mr, mc - i);
+		for (int k = 0; k < kc; k++)
 		{
-			C[i][j] = 0;
-			for (int k = 0; k < n2; k++)
-				C[i][j] += A[i][k] * B[k][j];
+			for (int ii = 0; ii < rows; ii++)
+				*packedA++ = A[startH + i + ii][startW + k];
+			for (int ii = rows; ii < mr; ii++)
+				*packedA++ = 0;
 		}
+	}
 }
 
+// copies B[startH..startH+kc)[startW..startW+nc) into NR-column strips, k-major inside a strip;
+// the last strip is padded with zeros
 template<typename T>
-void part_of_matrix_multiply(T** A, T** B, T** C, int n1, int n2, int n3, int cStartH, int cStartW)
+void pack_block_b(const Matrix<T>& B, T* packedB, int startH, int startW, int kc, int nc, int nr)
 {
-	for (int i = 0, cI = cStartH; i < n1; i++, cI++)
-		for (int j = 0, cJ = cStartW; j < n3; j++, cJ++)
+	for (int j = 0; j < nc; j += nr)
+	{
+		int cols = min(nr, nc - j);
+		for (int k = 0; k < kc; k++)
 		{
-			C[cI][cJ] = 0;
-			for (int k = 0; k < n2; k++)
-				C[cI][cJ] += A[i][k] * B[k][j];
+			const T* bRow = B[startH + k] + startW + j;
+			for (int jj = 0; jj < cols; jj++)
+				*packedB++ = bRow[jj];
+			for (int jj = cols; jj < nr; jj++)
+				*packedB++ = 0;
 		}
+	}
 }
 
+// false when the matrix can't be read (the reason is printed)
 template<typename T>
-void read_matrix_from_file(const char* fileName, T** matrix, int height, int width)
+bool read_matrix_from_file(const char* fileName, Matrix<T>& matrix, int height, int width)
 {
-	ifstream fin;
-	fin.open(fileName);
-
-	for (int i = 0; i < height; i++)
-		for (int j = 0; j < width; j++)
-			fin >> matrix[i][j];
+	if (is_binary_matrix_file(fileName))
+	{
+		if (read_matrix_file_slab(fileName, matrix.data(), matrix.ld(), 0, height, 0, width, true))
+			return true;
+		cout << "Can't read matrix " << fileName << ": bad header, size or checksum." << endl;
+		return false;
+	}
 
-	fin.close();
+	if (read_text_matrix_slab(fileName, matrix.data(), matrix.ld(), 0, height, 0, width))
+		return true;
+	cout << "Can't read matrix " << fileName << ": missing rows or bad elements." << endl;
+	return false;
 }
 
+// false when the slab can't be read (the reason is printed); the slab has to lie within the height x width matrix
 template<typename T>
-void read_part_of_matrix_from_file(const char* fileName, T** matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW)
+bool read_part_of_matrix_from_file(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW)
 {
-	T buffer;
-
-	ifstream fin;
-	fin.open(fileName);
+	if (startIndexH < 0 || startIndexW < 0 || endIndexH >= height || endIndexW >= width)
+	{
+		cout << "Can't read matrix " << fileName << ": rows " << startIndexH << ".." << endIndexH << " and columns " << startIndexW
+			<< ".." << endIndexW << " are outside its " << height << "x" << width << "." << endl;
+		return false;
+	}
 
-	for (int i = 0, matrix_i = 0; i < height; i++) 
+	// binary files are mapped and only the slab itself is touched; the whole-file checksum is skipped
+	if (is_binary_matrix_file(fileName))
 	{
-		for (int j = 0, matrix_j = 0; j < width; j++)
-			if (i >= startIndexH && i <= endIndexH && j >= startIndexW && j <= endIndexW)
-				fin >> matrix[matrix_i][matrix_j++];
-			else
-				fin >> buffer;
-		if (i >= startIndexH && i <= endIndexH)
-			matrix_i++;
+		if (read_matrix_file_slab(fileName, matrix.data(), matrix.ld(), startIndexH, endIndexH - startIndexH + 1, startIndexW, endIndexW - startIndexW + 1, false))
+			return true;
+		cout << "Can't read matrix " << fileName << ": bad header or size." << endl;
+		return false;
 	}
 
-	fin.close();
+	// text files are indexed by line ends, so only the rows of the slab are parsed
+	if (read_text_matrix_slab(fileName, matrix.data(), matrix.ld(), startIndexH, endIndexH - startIndexH + 1, startIndexW, endIndexW - startIndexW + 1))
+		return true;
+	cout << "Can't read matrix " << fileName << ": missing rows or bad elements." << endl;
+	return false;
 }
 
+// the slab from the operand cache of this rank, or from the file, keeping a copy in the cache when it could be read
 template<typename T>
-void print_matrix_to_file(const char* fileName, T** matrix, int height, int width)
+bool read_part_of_matrix_cached(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW)
 {
-	ofstream fout;
-	fout.open(fileName);
+	OperandKey key;
+	bool cacheable = make_operand_key(fileName, element_type_of<T>(), startIndexH, endIndexH - startIndexH + 1, startIndexW, endIndexW - startIndexW + 1, key);
+	if (cacheable && operand_cache().fetch(key, matrix.data(), matrix.ld()))
+		return true;
+
+	if (!read_part_of_matrix_from_file(fileName, matrix, height, width, startIndexH, endIndexH, startIndexW, endIndexW))
+		return false;
+	if (cacheable)
+		operand_cache().store(key, matrix.data(), matrix.ld());
+	return true;
+}
+
+// every rank of comm loads its slab at the same time: binary files through collective MPI-IO,
+// each rank viewing the file through a subarray type of its slab; text files are parsed concurrently.
+// False on every rank of comm when any of them couldn't read its slab (the reason is printed)
+template<typename T>
+bool read_part_of_matrix_collective(const char* fileName, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW, MPI_Comm comm)
+{
+	int read;
+	if (!is_binary_matrix_file(fileName))
+	{
+		read = read_part_of_matrix_from_file(fileName, matrix, height, width, startIndexH, endIndexH, startIndexW, endIndexW);
+		MPI_Allreduce(MPI_IN_PLACE, &read, 1, MPI_INT, MPI_LAND, comm);
+		return read;
+	}
+
+	// the reads below are collective, so no rank goes on unless all of them opened the file
+	MPI_File file;
+	int opened = MPI_File_open(comm, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) == MPI_SUCCESS, allOpened;
+	MPI_Allreduce(&opened, &allOpened, 1, MPI_INT, MPI_LAND, comm);
+	if (!allOpened)
+	{
+		if (opened)
+			MPI_File_close(&file);
+		cout << "Can't open matrix " << fileName << "." << endl;
+		return false;
+	}
 
-	for (int i = 0; i < height; i++)
+	// every rank reads the same header and size, so they all take the same branch
+	MatrixFileHeader header;
+	MPI_Status status;
+	MPI_Offset fileSize;
+	int headerBytes;
+	MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, &status);
+	MPI_Get_count(&status, MPI_BYTE, &headerBytes);
+	MPI_File_get_size(file, &fileSize);
+	if (headerBytes != (int)sizeof(header) || !check_matrix_file_header(header, (size_t)fileSize) || header.height != (uint64_t)height || header.width != (uint64_t)width)
+	{
+		cout << "Can't read matrix " << fileName << ": bad header, dimensions or size." << endl;
+		MPI_File_close(&file);
+		return false;
+	}
+	size_t elementSize = element_type_size(header.elementType);
+
+	// a column-major file is a width x height row-major array, so the slab is viewed transposed
+	bool columnMajor = header.layout == LAYOUT_COLUMN_MAJOR;
+	int sliceH = endIndexH - startIndexH + 1, sliceW = endIndexW - startIndexW + 1;
+	int sizes[2] = { columnMajor ? width : height, columnMajor ? height : width };
+	int subsizes[2] = { columnMajor ? sliceW : sliceH, columnMajor ? sliceH : sliceW };
+	int starts[2] = { columnMajor ? startIndexW : startIndexH, columnMajor ? startIndexH : startIndexW };
+	MPI_Datatype elementType = mpi_type_of_element(header.elementType);
+	int count = sliceH * sliceW, elements;
+
+	MPI_Datatype slab = elementType;
+	if (count > 0)
 	{
-		for (int j = 0; j < width; j++)
+		MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, elementType, &slab);
+		MPI_Type_commit(&slab);
+	}
+	MPI_File_set_view(file, header.dataOffset, elementType, slab, "native", MPI_INFO_NULL);
+
+	bool direct = !columnMajor && header.elementType == element_type_of<T>() && elementSize == sizeof(T) && matrix.ld() == sliceW;
+	if (direct)
+	{
+		MPI_File_read_at_all(file, 0, matrix.data(), count, elementType, &status);
+		MPI_Get_count(&status, elementType, &elements);
+	}
+	else
+	{
+		vector<char> buffer((size_t)count * elementSize);
+		MPI_File_read_at_all(file, 0, buffer.data(), count, elementType, &status);
+		MPI_Get_count(&status, elementType, &elements);
+
+		if (!columnMajor)
+			for (int i = 0; i < sliceH; i++)
+				convert_elements(buffer.data() + (size_t)i * sliceW * elementSize, header.elementType, matrix[i], sliceW);
+		else
 		{
-			fout << matrix[i][j];
-			if (j != width - 1)
-				fout << " ";
+			vector<T> column(sliceH);
+			for (int j = 0; j < sliceW; j++)
+			{
+				convert_elements(buffer.data() + (size_t)j * sliceH * elementSize, header.elementType, column.data(), sliceH);
+				for (int i = 0; i < sliceH; i++)
+					matrix[i][j] = column[i];
+			}
 		}
-		if (i != height - 1)
-			fout << endl;
 	}
 
-	fout.close();
+	if (count > 0)
+		MPI_Type_free(&slab);
+	MPI_File_close(&file);
+
+	read = elements == count;
+	if (!read)
+		cout << "Can't read matrix " << fileName << ": " << elements << " of the " << count << " elements of the slab were read." << endl;
+	MPI_Allreduce(MPI_IN_PLACE, &read, 1, MPI_INT, MPI_LAND, comm);
+	return read;
 }
 
+// false when the file can't be written (the reason is printed)
 template<typename T>
-void run_process_sync(char** fileNames)
+bool print_matrix_to_file(const char* fileName, const Matrix<T>& matrix, int height, int width)
 {
-	T** A = create_matrix<T>(N1, N2);
-	T** B = create_matrix<T>(N2, N3);
-	T** C = create_matrix<T>(N1, N3);
+	bool written = is_binary_file_name(fileName) ? write_matrix_file(fileName, matrix.data(), height, width, matrix.ld(), LAYOUT_ROW_MAJOR)
+		: write_text_matrix_file(fileName, matrix.data(), height, width, matrix.ld());
+	if (!written)
+		cout << "Can't write matrix " << fileName << "." << endl;
+	return written;
+}
 
-	read_matrix_from_file(fileNames[1], A, N1, N2);
-	read_matrix_from_file(fileNames[2], B, N2, N3);
+// every rank of comm writes rows [startIndexH, endIndexH] of a height x width matrix into one file at the same time.
+// A binary file gets its header from rank 0 and no checksum (FNV-1a can't be put together from slabs);
+// for a text file each rank formats its rows and finds its byte offset with a prefix sum of the text sizes.
+// False when the file can't be opened
+template<typename T>
+bool print_part_of_matrix_collective(const char* fileName, const Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, MPI_Comm comm)
+{
+	int procRank;
+	MPI_Comm_rank(comm, &procRank);
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	MPI_File file;
+	if (MPI_File_open(comm, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+	{
+		if (procRank == 0)
+			cout << "Can't write matrix " << fileName << "." << endl;
+		return false;
+	}
 
-	matrix_multiply(A, B, C, N1, N2, N3);
+	int rows = endIndexH - startIndexH + 1;
+	if (is_binary_file_name(fileName))
+	{
+		MPI_Datatype dataType = mpi_type_of<T>();
+		MatrixFileHeader header = make_matrix_file_header<T>(height, width, LAYOUT_ROW_MAJOR);
+
+		MPI_File_set_size(file, header.dataOffset + (MPI_Offset)height * width * sizeof(T));
+		if (procRank == 0)
+			MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+		MPI_Offset offset = header.dataOffset + (MPI_Offset)startIndexH * width * sizeof(T);
+		MPI_File_write_at_all(file, offset, matrix.data(), rows * width, dataType, MPI_STATUS_IGNORE);
+	}
+	else
+	{
+		vector<char> text;
+		format_text_rows(matrix.data(), rows, width, matrix.ld(), endIndexH == height - 1, text);
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(0, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), true);
+		long long size = (long long)text.size(), offset = 0, total = 0;
+		MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+		MPI_Allreduce(&size, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+		if (procRank == 0)
+			offset = 0;
 
-	print_matrix_to_file(fileNames[3], C, N1, N3);
+		MPI_File_set_size(file, total);
+		MPI_File_write_at_all(file, offset, text.data(), (int)size, MPI_CHAR, MPI_STATUS_IGNORE);
+	}
 
-	delete_matrix(A, N1);
-	delete_matrix(B, N2);
-	delete_matrix(C, N1);
+	MPI_File_close(&file);
+	return true;
 }
 
+// the binary scratch file of stream mode rewritten as the text file of C, a band of rows at a time,
+// the band with its text taking no more than budget bytes
 template<typename T>
-void move_chunk_to_matrix(T** C, T** Ctemp, int startIndexH, int endIndexH, int startIndexW, int endIndexW) 
+bool convert_stream_result(const char* binaryName, const char* textName, int height, int width, size_t budget)
 {
-	for (int i = startIndexH, tempI = 0; i <= endIndexH; i++, tempI++)
-		for (int j = startIndexW, tempJ = 0; j <= endIndexW; j++, tempJ++)
-			C[i][j] = Ctemp[tempI][tempJ];
+	ofstream fout(textName);
+	if (!fout)
+		return false;
+
+	size_t rowBytes = (size_t)max(width, 1) * (sizeof(T) + TEXT_MAX_ELEMENT_LENGTH + 1);
+	int rows = (int)max<size_t>(1, min<size_t>(height, budget / rowBytes));
+	Matrix<T> band(rows, width);
+	vector<char> text;
+	for (int startH = 0; startH < height; startH += rows)
+	{
+		int count = min(rows, height - startH);
+		if (!read_matrix_file_slab(binaryName, band.data(), band.ld(), startH, count, 0, width, false))
+			return false;
+		text.clear();
+		format_text_rows(band.data(), count, width, band.ld(), startH + count == height, text);
+		fout.write(text.data(), text.size());
+	}
+	return (bool)fout;
 }
 
-template<typename T>
-void run_process_0(char** fileNames)
+template<typename Ring>
+void run_process_sync(const Settings& settings, RunReport& report)
 {
-	MPI_Status status;
-	char *goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	typedef typename Ring::Element T;
+	int n1 = settings.n1, n2 = settings.n2, n3 = settings.n3;
+	Arena arena;
+	ThreadPool pool(settings.threads < 0 ? 0 : settings.threads);
+	Matrix<T> A(arena, n1, n2);
+	Matrix<T> B(arena, n2, n3);
+	Matrix<typename Ring::Result> C(arena, n1, n3);
+	bool strassen = strassen_enabled<Ring>(settings);
+	T* workspace = strassen ? (T*)arena.allocate(strassen_workspace_size<T>(n1, n2, n3, settings.strassenCutoff) * sizeof(T)) : nullptr;
+
+	if (!load_operand(settings, 1, A, n1, n2, 0, n1 - 1, 0, n2 - 1, MPI_COMM_NULL)
+		|| !load_operand(settings, 2, B, n2, n3, 0, n2 - 1, 0, n3 - 1, MPI_COMM_NULL))
+	{
+		report.error = "can't read the operands";
+		return;
+	}
+	normalize_matrix<Ring>(A);
+	normalize_matrix<Ring>(B);
+	vector<char> packedA, packedB;
+	bool sparseA = pack_if_sparse<Ring>(A, settings.sparseThreshold, packedA);
+	bool sparseB = pack_if_sparse<Ring>(B, settings.sparseThreshold, packedB);
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1, N3);
-	T** Ctemp = create_allocated_matrix<T>(N1, N3 / 8);
+	for (int repetition = 0; repetition < repetition_count(settings); repetition++)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
 
-	int sizeB = N2 * (N3 / 8);
+		{
+			TraceScope trace("multiply");
+			multiply_operands<Ring>(A, sparseA ? packedA.data() : nullptr, B, sparseB ? packedB.data() : nullptr, C, n1, n2, n3, strassen, workspace, settings, pool);
+		}
 
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 0, 1 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 1, 0, MPI_COMM_WORLD);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 0, 1 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 1, 1, MPI_COMM_WORLD);
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		record_repetition(settings, report, repetition, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), MPI_COMM_NULL);
+	}
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	if (settings.benchmark == 0)
+	{
+		if (settings.verify > 0)
+			verify_product<Ring>(settings, A, 0, n2, B, nullptr, 0, n2, 0, n3, C, 0, n3, n1, MPI_COMM_NULL, MPI_COMM_NULL, pool);
 
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+		TraceScope trace("write C");
+		print_matrix_to_file(settings.fileNames[3], C, n1, n3);
+	}
+}
 
-	for (int i = 0; i < 7; i++)
+// A is split into row blocks and B into column blocks, one of each per rank of comm.
+// Every step a rank multiplies its A rows by the B block it holds, then passes that block
+// to rank + 1 and receives the next one from rank - 1, so after comm size steps it has
+// its full row block of C. Block sizes differ by at most one row/column when the
+// dimensions are not divisible by the number of ranks
+template<typename Ring>
+void run_process_ring(const Settings& settings, MPI_Comm comm, RunReport& report)
+{
+	typedef typename Ring::Element T;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	Arena arena;
+	ThreadPool pool(settings.threads < 0 ? 1 : settings.threads);
+
+	int n1 = settings.n1, n2 = settings.n2, n3 = settings.n3;
+	int rowStart = block_start(procRank, n1, procNum);
+	int rows = block_size(procRank, n1, procNum);
+	int colStart = block_start(procRank, n3, procNum);
+	int cols = block_size(procRank, n3, procNum);
+	int maxCols = block_size(0, n3, procNum);
+
+	Matrix<T> A(arena, rows, n2);
+	Matrix<T> B(arena, n2, maxCols);
+	Matrix<T> Bnext(arena, n2, maxCols);
+	bool strassen = strassen_enabled<Ring>(settings);
+	T* workspace = strassen ? (T*)arena.allocate(strassen_workspace_size<T>(rows, n2, maxCols, settings.strassenCutoff) * sizeof(T)) : nullptr;
+	Matrix<typename Ring::Result> C(arena, procRank == 0 && settings.gather ? n1 : rows, n3);
+
+	Matrix<T> ownB(B.data(), n2, cols, cols);
+	if (!load_operand(settings, 1, A, n1, n2, rowStart, rowStart + rows - 1, 0, n2 - 1, comm)
+		|| !load_operand(settings, 2, ownB, n2, n3, 0, n2 - 1, colStart, colStart + cols - 1, comm))
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 1, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 7, i, MPI_COMM_WORLD, &status);
-		
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, (i+1) * (N1/8), 0);
+		report.error = "can't read the operands";
+		return;
 	}
-	
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(0, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+	normalize_matrix<Ring>(A);
+	normalize_matrix<Ring>(ownB);
+	vector<char> packedA;
+	bool sparseA = pack_if_sparse<Ring>(A, settings.sparseThreshold, packedA);
+	int formB, bytesB;
+	pack_ring_block<Ring>(settings, ownB, formB, bytesB);
+
+	// a repetition goes on from the block the previous one ended with
+	long long sentBytes = 0;
+	int firstBlock = procRank;
+	for (int repetition = 0; repetition < repetition_count(settings); repetition++)
+	{
+		if (settings.benchmark > 0)
+			MPI_Barrier(comm);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
 
-	print_matrix_to_file("proc_0.txt", C, N1 / 8, N3 / 8);
+		sentBytes += ring_pass<Ring>(settings, comm, A, sparseA ? packedA.data() : nullptr, B, Bnext, formB, bytesB, C, firstBlock, n2, n3, strassen, workspace, pool);
+		firstBlock = (firstBlock + 1) % procNum;
 
-	for (int i = 1; i < 8; i++) {
-		MPI_Recv(&(Ctemp[0][0]), N1 * (N3 / 8), dataType, i, 200, MPI_COMM_WORLD, &status);
-		move_chunk_to_matrix<T>(C, Ctemp, 0, N1 - 1, i * (N3 / 8), (i+1) * (N3 / 8) - 1);
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		record_repetition(settings, report, repetition, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), comm);
 	}
-	
-	print_matrix_to_file(fileNames[3], C, N1, N3);
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1);
-	delete_allocated_matrix<T>(Ctemp, N1);
-	delete goFlag;
+	if (settings.benchmark > 0)
+	{
+		MPI_Allreduce(&sentBytes, &report.bytesMoved, 1, MPI_LONG_LONG, MPI_SUM, comm);
+		report.bytesMoved /= repetition_count(settings);
+		return;
+	}
+
+	// B holds the block of the last step, the one the next pass would start with; a narrow one is unpacked into Bnext
+	if (settings.verify > 0)
+	{
+		int heldCols = block_size(firstBlock, n3, procNum);
+		Matrix<T> heldB(formB == TAG_RING_NARROW ? Bnext.data() : B.data(), n2, heldCols, heldCols);
+		if (formB == TAG_RING_NARROW)
+			unpack_narrow((const char*)B.data(), heldB, pool);
+		verify_product<Ring>(settings, A, 0, n2, heldB, formB == TAG_RING_SPARSE ? (const char*)B.data() : nullptr, 0, n2, block_start(firstBlock, n3, procNum), heldCols, C, 0, n3, rows, comm, MPI_COMM_NULL, pool);
+	}
+
+	{
+		TraceScope trace("write proc file");
+		char procFileName[MAX_NAME_LENGTH];
+		snprintf(procFileName, MAX_NAME_LENGTH, "proc_%d.txt", procRank);
+		print_matrix_to_file(procFileName, C, rows, n3);
+	}
+
+	write_row_blocks(settings, C, n1, n3, rowStart, rows, comm, pool);
 }
 
-template<typename T>
-void run_process_1(char** fileNames)
+// one pass of B around the ring: the A rows of this rank (packed in sparseA when not null) times every B block
+// in turn, starting with block firstBlock, which B holds. A block travels as it came in bytesB bytes, and formB
+// is its tag: dense (TAG_RING, n2 x its columns), packed sparse (TAG_RING_SPARSE) or bit packed narrow
+// (TAG_RING_NARROW, unpacked into a dense block of its own for the multiply), so a receiver learns the form
+// from the message; the buffers hold any dense block, so they hold the smaller packed ones too. With pipelining
+// the block being multiplied is sent on and its successor received into Bnext at the same time; both transfers
+// only have to finish at the step boundary. B and Bnext swap every step. Returns the bytes this rank sent
+template<typename Ring, typename T>
+long long ring_pass(const Settings& settings, MPI_Comm comm, const Matrix<T>& A, const char* sparseA, Matrix<T>& B, Matrix<T>& Bnext, int& formB, int& bytesB, Matrix<typename Ring::Result>& C, int firstBlock, int n2, int n3, bool strassen, T* workspace, ThreadPool& pool)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	MPI_Status statuses[2];
+	MPI_Request requests[2];
+	int next = (procRank + 1) % procNum;
+	int prev = (procRank - 1 + procNum) % procNum;
+	int rows = A.height();
+	int capacity = (int)((size_t)n2 * block_size(0, n3, procNum) * sizeof(T));
+	long long sentBytes = 0;
+	Matrix<T> unpacked;
+
+	for (int step = 0; step < procNum; step++)
+	{
+		int block = (firstBlock - step + procNum) % procNum;
+		int blockCols = block_size(block, n3, procNum);
+		bool passOn = step < procNum - 1;
+		int tag = formB;
+		if (formB == TAG_RING_NARROW && unpacked.size() == 0)
+			unpacked = Matrix<T>(n2, block_size(0, n3, procNum));
+		Matrix<T> blockB(formB == TAG_RING_NARROW ? unpacked.data() : B.data(), n2, blockCols, blockCols);
+
+		if (passOn && settings.pipeline)
+		{
+			MPI_Irecv(Bnext.data(), capacity, MPI_BYTE, prev, MPI_ANY_TAG, comm, &requests[0]);
+			MPI_Isend(B.data(), bytesB, MPI_BYTE, next, tag, comm, &requests[1]);
+		}
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1/8, N3);
+		if (formB == TAG_RING_NARROW)
+		{
+			TraceScope trace("unpack B", step);
+			unpack_narrow((const char*)B.data(), blockB, pool);
+		}
 
-	int sizeB = N2 * (N3 / 8);
+		{
+			TraceScope trace("multiply", step);
+			Matrix<typename Ring::Result> blockC = C.view(0, block_start(block, n3, procNum), rows, blockCols);
+			multiply_operands<Ring>(A, sparseA, blockB, formB == TAG_RING_SPARSE ? (const char*)B.data() : nullptr, blockC, rows, n2, blockCols, strassen, workspace, settings, pool);
+		}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 0, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 1 * (N1 / 8), 2 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 2, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 0, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 1 * (N3 / 8), 2 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 2, 1, MPI_COMM_WORLD);
+		if (!passOn)
+			break;
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+		{
+			TraceScope trace(settings.pipeline ? "wait B" : "exchange B", step);
+			if (settings.pipeline)
+				MPI_Waitall(2, requests, statuses);
+			else
+				MPI_Sendrecv(B.data(), bytesB, MPI_BYTE, next, tag,
+					Bnext.data(), capacity, MPI_BYTE, prev, MPI_ANY_TAG, comm, &statuses[0]);
+		}
+		swap(B, Bnext);
+		sentBytes += bytesB;
+		formB = statuses[0].MPI_TAG;
+		MPI_Get_count(&statuses[0], MPI_BYTE, &bytesB);
+	}
+	return sentBytes;
+}
 
-	for (int i = 0; i < 7; i++)
+// the own B block, dense at the start of the B buffer, is packed in place when it is sparse enough and the packed
+// form is the smaller one, else bit packed when it is narrow enough and the packed form is the smaller one, so a packed
+// block always fits the buffers of the ring; form is the tag it travels with
+template<typename Ring, typename T>
+void pack_ring_block(const Settings& settings, const Matrix<T>& ownB, int& form, int& bytes)
+{
+	vector<char> packed;
+	size_t denseBytes = ownB.size() * sizeof(T);
+	if (pack_if_sparse<Ring>(ownB, settings.sparseThreshold, packed) && packed.size() < denseBytes)
+		form = TAG_RING_SPARSE;
+	else if (pack_if_narrow(ownB, settings.narrowRatio, packed) && packed.size() < denseBytes)
+		form = TAG_RING_NARROW;
+	else
+		form = TAG_RING;
+	bytes = (int)(form == TAG_RING ? denseBytes : packed.size());
+	if (form != TAG_RING)
+		memcpy(ownB.data(), packed.data(), packed.size());
+}
+
+// the batch on the ring: every job runs on all ranks of comm, one after the other. While job k multiplies,
+// a helper thread of every rank loads the A rows and B columns of job k + 1 (straight from the files, without
+// MPI) and, on rank 0, writes C of job k - 1. Operands load into two alternating buffer sets and C is gathered
+// into two alternating buffers; each set has its own arena and is only laid out again when its next job has
+// another shape. Without the gather C is written collectively and doesn't overlap. No proc_N.txt files are written.
+// The slabs come from the operand cache when an earlier job (of this batch or of the server) loaded them.
+// The first operand this rank can't read or C it can't write goes into report.error
+template<typename Ring>
+void run_batch_ring(const Settings& settings, MPI_Comm comm, RunReport& report)
+{
+	typedef typename Ring::Element T;
+	typedef typename Ring::Result R;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	ThreadPool pool(settings.threads < 0 ? 1 : settings.threads);
+	const vector<BatchJob>& jobs = settings.batchJobs;
+	bool strassen = strassen_enabled<Ring>(settings);
+	operand_cache().set_capacity((size_t)max(settings.cacheMegabytes, 0) << 20);
+
+	struct Buffers
+	{
+		Arena arena;
+		int shape[3] = { -1, -1, -1 };
+		Matrix<T> first;
+		Matrix<T> second;
+		// operands only: A packed when sparse (empty when dense), the form (ring tag) and bytes of the own B block
+		vector<char> packed;
+		int form = TAG_RING;
+		int bytes = 0;
+
+		// true when the buffers had to be laid out again for the new shape
+		bool reshape(int n1, int n2, int n3)
+		{
+			if (shape[0] == n1 && shape[1] == n2 && shape[2] == n3)
+				return false;
+			first = Matrix<T>();
+			second = Matrix<T>();
+			arena.reset();
+			shape[0] = n1;
+			shape[1] = n2;
+			shape[2] = n3;
+			return true;
+		}
+	};
+	// A and B of a job; Bnext and the Strassen workspace; C of a job (a whole n1 x n3 one on rank 0 with the gather)
+	Buffers operands[2], work;
+	Arena resultArenas[2];
+	Matrix<R> results[2];
+	int resultShapes[2][2] = { { -1, -1 }, { -1, -1 } };
+	T* workspace = nullptr;
+
+	auto load = [&](int k)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 2, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 0, i + 2, MPI_COMM_WORLD, &status);
+		const BatchJob& job = jobs[k];
+		Buffers& buffers = operands[k % 2];
+		int rowStart = block_start(procRank, job.n1, procNum), rows = block_size(procRank, job.n1, procNum);
+		int colStart = block_start(procRank, job.n3, procNum), cols = block_size(procRank, job.n3, procNum);
+		if (buffers.reshape(job.n1, job.n2, job.n3))
+		{
+			buffers.first = Matrix<T>(buffers.arena, rows, job.n2);
+			buffers.second = Matrix<T>(buffers.arena, job.n2, block_size(0, job.n3, procNum));
+		}
+
+		Matrix<T> ownB(buffers.second.data(), job.n2, cols, cols);
+		string error;
+		if (!read_part_of_matrix_cached(job.fileNames[0].c_str(), buffers.first, job.n1, job.n2, rowStart, rowStart + rows - 1, 0, job.n2 - 1))
+			error = "can't read " + job.fileNames[0];
+		if (!read_part_of_matrix_cached(job.fileNames[1].c_str(), ownB, job.n2, job.n3, 0, job.n2 - 1, colStart, colStart + cols - 1) && error.empty())
+			error = "can't read " + job.fileNames[1];
+		normalize_matrix<Ring>(buffers.first);
+		normalize_matrix<Ring>(ownB);
+		buffers.packed.clear();
+		pack_if_sparse<Ring>(buffers.first, settings.sparseThreshold, buffers.packed);
+		pack_ring_block<Ring>(settings, ownB, buffers.form, buffers.bytes);
+		return error;
+	};
+	auto note = [&report](const string& error)
+	{
+		if (report.error.empty())
+			report.error = error;
+	};
+
+	future<string> loading = async(launch::async, load, 0), writing;
+	chrono::high_resolution_clock::time_point batchStart = chrono::high_resolution_clock::now();
+	for (int k = 0; k < (int)jobs.size(); k++)
+	{
+		const BatchJob& job = jobs[k];
+		int n1 = job.n1, n2 = job.n2, n3 = job.n3;
+		int rowStart = block_start(procRank, n1, procNum), rows = block_size(procRank, n1, procNum);
+		{
+			TraceScope trace("wait load", k);
+			note(loading.get());
+		}
+		if (k + 1 < (int)jobs.size())
+			loading = async(launch::async, load, k + 1);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		// the C buffer of job k was last written out for job k - 2, which has finished before job k - 1 started writing
+		Matrix<R>& C = results[k % 2];
+		int resultHeight = procRank == 0 && settings.gather ? n1 : rows;
+		if (resultShapes[k % 2][0] != resultHeight || resultShapes[k % 2][1] != n3)
+		{
+			C = Matrix<R>();
+			resultArenas[k % 2].reset();
+			C = Matrix<R>(resultArenas[k % 2], resultHeight, n3);
+			resultShapes[k % 2][0] = resultHeight;
+			resultShapes[k % 2][1] = n3;
+		}
+		if (work.reshape(n1, n2, n3))
+		{
+			int maxCols = block_size(0, n3, procNum);
+			work.first = Matrix<T>(work.arena, n2, maxCols);
+			workspace = strassen ? (T*)work.arena.allocate(strassen_workspace_size<T>(rows, n2, maxCols, settings.strassenCutoff) * sizeof(T)) : nullptr;
+		}
+
+		// the pass swaps views, so the buffers themselves stay with their sets
+		Buffers& buffers = operands[k % 2];
+		Matrix<T> B(buffers.second.data(), n2, buffers.second.width(), buffers.second.ld());
+		Matrix<T> Bnext(work.first.data(), n2, work.first.width(), work.first.ld());
+		ring_pass<Ring>(settings, comm, buffers.first, buffers.packed.empty() ? nullptr : buffers.packed.data(), B, Bnext,
+			buffers.form, buffers.bytes, C, procRank, n2, n3, strassen, workspace, pool);
+
+		if (settings.gather)
+		{
+			{
+				TraceScope trace("gather C", k);
+				gather_row_blocks(settings, C, n1, n3, rows, comm, pool);
+			}
+			if (procRank == 0)
+			{
+				TraceScope trace("wait write", k);
+				if (writing.valid())
+					note(writing.get());
+				writing = async(launch::async, [&C, &job] { return print_matrix_to_file(job.fileNames[2].c_str(), C, job.n1, job.n3) ? string() : "can't write " + job.fileNames[2]; });
+			}
+		}
+		else
+		{
+			TraceScope trace("write C", k);
+			if (!print_part_of_matrix_collective(job.fileNames[2].c_str(), C, n1, n3, rowStart, rowStart + rows - 1, comm))
+				note("can't write " + job.fileNames[2]);
+		}
+
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		if (procRank == 0)
+			cout << "Batch job " << job.fileNames[0] << " x " << job.fileNames[1] << " -> " << job.fileNames[2] << " (" << job.type << ", "
+				<< n1 << "x" << n2 << "x" << n3 << "): " << chrono::duration_cast<chrono::nanoseconds>(end - start).count() << " ns." << endl;
+	}
+	if (writing.valid())
+		note(writing.get());
+
+	chrono::high_resolution_clock::time_point batchEnd = chrono::high_resolution_clock::now();
+	print_time(procRank, chrono::duration_cast<chrono::nanoseconds>(batchEnd - batchStart).count(), false);
+}
+
+// C tile by tile from the files, see stream.h. A step of a rank multiplies one pair of A and B tiles into its
+// current C tile; a helper thread reads the pair of the next step meanwhile, and writes a finished C tile
+// while the next one is summed. The ranks share nothing but the C file, each writing its own tiles of it
+template<typename Ring>
+void run_process_stream(const Settings& settings, MPI_Comm comm, RunReport& report)
+{
+	typedef typename Ring::Element T;
+	typedef typename Ring::Result R;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	int n1 = settings.n1, n2 = settings.n2, n3 = settings.n3;
+	size_t budget = (size_t)max(settings.memoryMegabytes, 1) << 20;
+	StreamPlan plan = plan_stream(n1, n2, n3, budget, sizeof(T), sizeof(R));
+	if (procRank == 0 && !plan.fits)
+		cout << "Stream mode: " << settings.memoryMegabytes << " MB can't hold the smallest tiles, using "
+			<< plan.tileH << "x" << plan.tileK << "x" << plan.tileW << " tiles." << endl;
+
+	// a text C is assembled in a binary scratch file and converted at the end
+	bool writes = settings.benchmark == 0;
+	bool binary = is_binary_file_name(settings.fileNames[3]);
+	string resultName = binary ? string(settings.fileNames[3]) : string(settings.fileNames[3]) + STREAM_SCRATCH_SUFFIX;
+	if (writes)
+	{
+		int created = procRank != 0 || create_matrix_file<R>(resultName.c_str(), n1, n3);
+		MPI_Bcast(&created, 1, MPI_INT, 0, comm);
+		if (!created)
+		{
+			if (procRank == 0)
+				cout << "Can't write matrix " << resultName << "." << endl;
+			return;
+		}
+	}
+
+	ThreadPool pool(settings.threads < 0 ? 1 : settings.threads);
+	Matrix<T> A[2] = { Matrix<T>(plan.tileH, plan.tileK), Matrix<T>(plan.tileH, plan.tileK) };
+	Matrix<T> B[2] = { Matrix<T>(plan.tileK, plan.tileW), Matrix<T>(plan.tileK, plan.tileW) };
+	Matrix<R> C[2] = { Matrix<R>(plan.tileH, plan.tileW), Matrix<R>(plan.tileH, plan.tileW) };
+	int steps = stream_step_count(plan, procRank, procNum);
+
+	// a text operand is mapped and its rows indexed once for the run, not again for every tile; the index
+	// takes two pointers a row, and the mapped pages are the system's to drop
+	TextMatrixFile texts[2];
+	for (int operand = 1; operand <= 2; operand++)
+		if (settings.benchmark == 0 && steps > 0 && !is_binary_matrix_file(settings.fileNames[operand]) && !open_text_matrix_file(settings.fileNames[operand], texts[operand - 1]))
+			cout << "Can't open matrix " << settings.fileNames[operand] << "." << endl;
+
+	auto load = [&](int step)
+	{
+		StreamStep tiles = stream_step(plan, procRank, procNum, step);
+		Matrix<T> tileA = A[step % 2].view(0, 0, tiles.height, tiles.depth);
+		Matrix<T> tileB = B[step % 2].view(0, 0, tiles.depth, tiles.width);
+		load_operand_tile(settings, 1, texts[0], tileA, n1, n2, tiles.startH, tiles.startH + tiles.height - 1, tiles.startK, tiles.startK + tiles.depth - 1);
+		load_operand_tile(settings, 2, texts[1], tileB, n2, n3, tiles.startK, tiles.startK + tiles.depth - 1, tiles.startW, tiles.startW + tiles.width - 1);
+		normalize_matrix<Ring>(tileA);
+		normalize_matrix<Ring>(tileB);
+	};
+
+	for (int repetition = 0; repetition < repetition_count(settings); repetition++)
+	{
+		if (settings.benchmark > 0)
+			MPI_Barrier(comm);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		future<void> loading, writing;
+		if (steps > 0)
+			loading = async(launch::async, load, 0);
+		for (int step = 0; step < steps; step++)
+		{
+			StreamStep tiles = stream_step(plan, procRank, procNum, step);
+			{
+				TraceScope trace("wait load", step);
+				loading.get();
+			}
+			if (step + 1 < steps)
+				loading = async(launch::async, load, step + 1);
+
+			// the C buffer of this tile was last written out two tiles ago, which finished before the previous tile started writing
+			Matrix<R>& result = C[tiles.slot % 2];
+			Matrix<R> tileC = result.view(0, 0, tiles.height, tiles.width);
+			if (tiles.k == 0)
+				tileC.fill(Ring::zero());
+			{
+				TraceScope trace("multiply", step);
+				part_of_matrix_multiply_add<Ring>(A[step % 2], B[step % 2], tileC, tiles.height, tiles.depth, tiles.width, 0, 0, pool, settings.tileRows, settings.tileCols);
+			}
+
+			if (writes && tiles.k == plan.depthTiles - 1)
+			{
+				{
+					TraceScope trace("wait write", step);
+					if (writing.valid())
+						writing.get();
+				}
+				writing = async(launch::async, [&resultName, &result, tiles]
+				{
+					if (!write_matrix_file_slab(resultName.c_str(), result.data(), result.ld(), tiles.startH, tiles.height, tiles.startW, tiles.width))
+						cout << "Can't write matrix " << resultName << "." << endl;
+				});
+			}
+		}
+		if (writing.valid())
+		{
+			TraceScope trace("wait write");
+			writing.get();
+		}
 
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		record_repetition(settings, report, repetition, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), comm);
 	}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(1, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+	if (!writes)
+		return;
 
-	print_matrix_to_file("proc_1.txt", C, N1 / 8, N3 / 8);
+	// every tile is in the file once all ranks are through
+	MPI_Barrier(comm);
+	if (procRank != 0)
+		return;
+	TraceScope trace("finish C");
+	if (binary)
+	{
+		if (!seal_matrix_file(resultName.c_str()))
+			cout << "Can't write matrix " << resultName << "." << endl;
+		return;
+	}
+	if (!convert_stream_result<R>(resultName.c_str(), settings.fileNames[3], n1, n3, budget))
+		cout << "Can't write matrix " << settings.fileNames[3] << "." << endl;
+	remove(resultName.c_str());
+}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+// brings the elements read from a file into the ring (residues modulo p for modp)
+template<typename Ring, typename T>
+void normalize_matrix(Matrix<T>& matrix)
+{
+	if (!Ring::normalizes)
+		return;
+	for (int i = 0; i < matrix.height(); i++)
+		for (int j = 0; j < matrix.width(); j++)
+			matrix[i][j] = Ring::normalize(matrix[i][j]);
+}
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1/8);
-	delete goFlag;
+// rows [startIndexH, endIndexH] and columns [startIndexW, endIndexW] of operand 1 (A) or 2 (B), read from its
+// file collectively over comm, or alone when comm is MPI_COMM_NULL. A benchmark makes the operands up instead:
+// small integers from the position in the full matrix, whichever rank holds the element, so any shape can
+// be swept without files. False when the operand couldn't be read, on every rank of comm
+template<typename T>
+bool load_operand(const Settings& settings, int operand, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW, MPI_Comm comm)
+{
+	TraceScope trace(operand == 1 ? "read A" : "read B");
+	if (settings.benchmark > 0)
+	{
+		synthesize_operand(operand, matrix, startIndexH, endIndexH, startIndexW, endIndexW);
+		return true;
+	}
+
+	if (comm == MPI_COMM_NULL)
+		return read_matrix_from_file(settings.fileNames[operand], matrix, height, width);
+	return read_part_of_matrix_collective<T>(settings.fileNames[operand], matrix, height, width, startIndexH, endIndexH, startIndexW, endIndexW, comm);
 }
 
+// a tile of operand 1 (A) or 2 (B) for stream mode, read by this rank alone or made up in a benchmark. A text
+// operand is read through text, the file as the run mapped and indexed it (a binary one leaves text empty).
+// It runs on the helper thread, so it notes no trace phase
 template<typename T>
-void run_process_2(char** fileNames)
+void load_operand_tile(const Settings& settings, int operand, const TextMatrixFile& text, Matrix<T>& matrix, int height, int width, int startIndexH, int endIndexH, int startIndexW, int endIndexW)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	if (settings.benchmark > 0)
+		synthesize_operand(operand, matrix, startIndexH, endIndexH, startIndexW, endIndexW);
+	else if (text.file.data() == nullptr)
+		read_part_of_matrix_from_file(settings.fileNames[operand], matrix, height, width, startIndexH, endIndexH, startIndexW, endIndexW);
+	else if (!read_text_rows(text.index, matrix.data(), matrix.ld(), startIndexH, endIndexH - startIndexH + 1, startIndexW, endIndexW - startIndexW + 1))
+		cout << "Can't read matrix " << settings.fileNames[operand] << ": missing rows or bad elements." << endl;
+}
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+template<typename T>
+void synthesize_operand(int operand, Matrix<T>& matrix, int startIndexH, int endIndexH, int startIndexW, int endIndexW)
+{
+	for (int i = 0; i <= endIndexH - startIndexH; i++)
+		for (int j = 0; j <= endIndexW - startIndexW; j++)
+			matrix[i][j] = (T)(((long long)(startIndexH + i) * 7 + (long long)(startIndexW + j) * 13 + operand) % 9 + 1);
+}
 
-	int sizeB = N2 * (N3 / 8);
+template<typename T>
+MPI_Datatype mpi_type_of()
+{
+	return mpi_type_of_element(element_type_of<T>());
+}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 1, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 2 * (N1 / 8), 3 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 3, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 1, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 2 * (N3 / 8), 3 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 3, 1, MPI_COMM_WORLD);
+// the ranks of comm hold consecutive row blocks of the n1 x n3 result, rank 0 holding room for all of C
+// unless gather is off, when every rank writes its own rows
+template<typename T>
+void write_row_blocks(const Settings& settings, Matrix<T>& C, int n1, int n3, int rowStart, int rows, MPI_Comm comm, ThreadPool& pool)
+{
+	int procRank;
+	MPI_Comm_rank(comm, &procRank);
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+	if (!settings.gather)
+	{
+		TraceScope trace("write C");
+		print_part_of_matrix_collective(settings.fileNames[3], C, n1, n3, rowStart, rowStart + rows - 1, comm);
+		return;
+	}
 
-	for (int i = 0; i < 7; i++)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 3, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 1, i + 2, MPI_COMM_WORLD, &status);
-		
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+		TraceScope trace("gather C");
+		gather_row_blocks(settings, C, n1, n3, rows, comm, pool);
 	}
+	if (procRank == 0)
+	{
+		TraceScope trace("write C");
+		print_matrix_to_file(settings.fileNames[3], C, n1, n3);
+	}
+}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(2, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+// C(i, j) sits at the start of `result`. The first rank of every grid row collects the blocks of its row
+// into a full row strip (result is rows x n3 there, a vector type placing each block), then the first
+// grid column hands the strips on as row blocks: gathered on rank (0, 0) or written in parallel
+template<typename T>
+void write_grid_blocks(const Settings& settings, Matrix<T>& result, int n1, int n3, int rowStart, int rows, const int dims[2], const int coords[2], MPI_Comm rowComm, MPI_Comm colComm, ThreadPool& pool)
+{
+	MPI_Datatype dataType = mpi_type_of<T>();
+	int cols = block_size(coords[1], n3, dims[1]);
 
-	print_matrix_to_file("proc_2.txt", C, N1 / 8, N3 / 8);
+	if (coords[1] != 0)
+	{
+		TraceScope trace("collect row strip");
+		if (rows * cols > 0)
+			MPI_Send(result.data(), rows * cols, dataType, 0, TAG_GRID_GATHER, rowComm);
+		return;
+	}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+	{
+		TraceScope trace("collect row strip");
+		vector<MPI_Request> requests;
+		for (int j = 1; j < dims[1]; j++)
+		{
+			int blockCols = block_size(j, n3, dims[1]);
+			if (rows * blockCols == 0)
+				continue;
+			MPI_Datatype blockType;
+			MPI_Type_vector(rows, blockCols, result.ld(), dataType, &blockType);
+			MPI_Type_commit(&blockType);
+			requests.push_back(MPI_REQUEST_NULL);
+			MPI_Irecv(result.data() + block_start(j, n3, dims[1]), 1, blockType, j, TAG_GRID_GATHER, rowComm, &requests.back());
+			MPI_Type_free(&blockType);
+		}
+		MPI_Waitall((int)requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+	}
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+	write_row_blocks(settings, result, n1, n3, rowStart, rows, colComm, pool);
 }
 
+// collects the row blocks of comm in C on rank 0 (see write_row_blocks). C row blocks are contiguous, so the dense
+// blocks go in one MPI_Gatherv that lands each of them straight in its place in C (the block of rank 0 already is
+// there). A narrow block goes bit packed instead: every rank learns the packed sizes (0 for a dense block), the
+// Gatherv leaves the packed blocks out, and rank 0 receives them side by side and unpacks them
 template<typename T>
-void run_process_3(char** fileNames)
+void gather_row_blocks(const Settings& settings, Matrix<T>& C, int n1, int n3, int rows, MPI_Comm comm, ThreadPool& pool)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+	MPI_Datatype dataType = mpi_type_of<T>();
+
+	vector<char> packed;
+	vector<int> sizes(procNum);
+	int packedBytes = procRank != 0 && pack_if_narrow(C.view(0, 0, rows, n3), settings.narrowRatio, packed) ? (int)packed.size() : 0;
+	MPI_Allgather(&packedBytes, 1, MPI_INT, sizes.data(), 1, MPI_INT, comm);
+
+	vector<size_t> offsets(procNum + 1, 0);
+	for (int i = 0; i < procNum; i++)
+		offsets[i + 1] = offsets[i] + sizes[i];
+	vector<MPI_Request> requests;
+	if (procRank == 0)
+	{
+		packed.resize(offsets[procNum]);
+		for (int i = 1; i < procNum; i++)
+			if (sizes[i] > 0)
+			{
+				requests.push_back(MPI_REQUEST_NULL);
+				MPI_Irecv(packed.data() + offsets[i], sizes[i], MPI_BYTE, i, TAG_ROW_GATHER, comm, &requests.back());
+			}
+	}
+	else if (packedBytes > 0)
+	{
+		requests.push_back(MPI_REQUEST_NULL);
+		MPI_Isend(packed.data(), packedBytes, MPI_BYTE, 0, TAG_ROW_GATHER, comm, &requests.back());
+	}
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+	vector<int> counts(procNum), displacements(procNum);
+	for (int i = 0; i < procNum; i++)
+	{
+		counts[i] = sizes[i] > 0 ? 0 : block_size(i, n1, procNum) * n3;
+		displacements[i] = block_start(i, n1, procNum) * n3;
+	}
+	if (procRank == 0)
+		MPI_Gatherv(MPI_IN_PLACE, 0, dataType, C.data(), counts.data(), displacements.data(), dataType, 0, comm);
+	else
+		MPI_Gatherv(C.data(), counts[procRank], dataType, nullptr, nullptr, nullptr, dataType, 0, comm);
+	MPI_Waitall((int)requests.size(), requests.data(), MPI_STATUSES_IGNORE);
 
-	int sizeB = N2 * (N3 / 8);
+	if (procRank != 0)
+		return;
+	for (int i = 1; i < procNum; i++)
+		if (sizes[i] > 0)
+		{
+			Matrix<T> block = C.view(block_start(i, n1, procNum), 0, block_size(i, n1, procNum), n3);
+			unpack_narrow(packed.data() + offsets[i], block, pool);
+		}
+}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 2, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 3 * (N1 / 8), 4 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 4, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 2, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 3 * (N3 / 8), 4 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 4, 1, MPI_COMM_WORLD);
+// Freivalds' check of the product the ranks of comm hold (see verify.h). A rank holds the rows x aCols block of A at
+// column aColStart, the bRows x bCols block of B at (bRowStart, bColStart), packed in sparseB when that isn't null,
+// and the rows x cCols block of C at column cColStart, the rows of A and C being the same. The B blocks of comm cover B
+// once and the A and C blocks of rowComm cover its rows once. B R is summed over comm, A (B R) and C R over rowComm,
+// whose first rank compares its rows; rank 0 of comm reports. A null rowComm means the rank holds whole rows,
+// a null comm that there is no MPI (sync). Rank 0 draws the seed of R and shares it
+template<typename Ring, typename T>
+void verify_product(const Settings& settings, const Matrix<T>& A, int aColStart, int aCols, const Matrix<T>& B, const char* sparseB, int bRowStart, int bRows, int bColStart, int bCols, const Matrix<typename Ring::Result>& C, int cColStart, int cCols, int rows, MPI_Comm comm, MPI_Comm rowComm, ThreadPool& pool)
+{
+	typedef typename VerifierOf<Ring>::type Verifier;
+	typedef typename Verifier::Value Value;
+	TraceScope trace("verify");
+	int procRank = 0, rowRank = 0, rounds = settings.verify;
+	if (comm != MPI_COMM_NULL)
+		MPI_Comm_rank(comm, &procRank);
+	if (rowComm != MPI_COMM_NULL)
+		MPI_Comm_rank(rowComm, &rowRank);
+	MPI_Datatype valueType = is_same<Value, double>::value ? MPI_DOUBLE : MPI_UINT64_T;
+
+	unsigned long long seed = (unsigned long long)chrono::high_resolution_clock::now().time_since_epoch().count();
+	if (comm != MPI_COMM_NULL)
+		MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, comm);
+
+	// R, then Y = B R (n2 x rounds) and the two sides A Y and C R (rows x rounds each) one after the other
+	int n2 = settings.n2, n3 = settings.n3;
+	vector<Value> r((size_t)n3 * rounds), y((size_t)n2 * rounds, Verifier::zero()), sides((size_t)2 * rows * rounds, Verifier::zero());
+	fill_verify_vectors<Verifier>(seed, n3, rounds, r.data());
+	Value* products = sides.data();
+	Value* checks = sides.data() + (size_t)rows * rounds;
+	if (sparseB)
+		verify_sparse_multiply_add<Verifier>(sparse_view<T>(sparseB), r.data() + (size_t)bColStart * rounds, y.data() + (size_t)bRowStart * rounds, rounds);
+	else
+		verify_multiply_add<Verifier>(B, bRows, bCols, r.data() + (size_t)bColStart * rounds, y.data() + (size_t)bRowStart * rounds, rounds, pool);
+	if (comm != MPI_COMM_NULL)
+	{
+		MPI_Allreduce(MPI_IN_PLACE, y.data(), (int)y.size(), valueType, mpi_op_of(Verifier::reduction), comm);
+		for (Value& value : y)
+			value = Verifier::reduce(value);
+	}
+	verify_multiply_add<Verifier>(A, rows, aCols, y.data() + (size_t)aColStart * rounds, products, rounds, pool);
+	verify_multiply_add<Verifier>(C, rows, cCols, r.data() + (size_t)cColStart * rounds, checks, rounds, pool);
+	if (rowComm != MPI_COMM_NULL)
+	{
+		MPI_Allreduce(MPI_IN_PLACE, sides.data(), (int)sides.size(), valueType, mpi_op_of(Verifier::reduction), rowComm);
+		for (Value& value : sides)
+			value = Verifier::reduce(value);
+	}
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+	// the real rings allow each element the tolerance times the magnitude of its terms, worked out the same way.
+	// Strassen's error is only bounded normwise: every element is allowed the bound of the largest magnitude,
+	// and the tolerance grows with the levels of the whole product, which no block exceeds
+	vector<double> bounds((size_t)rows * rounds, 0);
+	if constexpr (!Verifier::exact)
+	{
+		typedef typename Verifier::Magnitude Magnitude;
+		bool strassen = strassen_enabled<Ring>(settings);
+		double tolerance = settings.verifyTolerance > 0 ? settings.verifyTolerance : VERIFY_ERROR_FACTOR * n2 * Verifier::epsilon();
+		if (strassen && settings.verifyTolerance <= 0)
+			tolerance *= verify_strassen_growth(settings.n1, n2, n3, settings.strassenCutoff);
+		vector<double> rMagnitude(r.size()), yMagnitude(y.size(), Magnitude::zero()), sidesMagnitude(sides.size(), Magnitude::zero());
+		for (size_t e = 0; e < r.size(); e++)
+			rMagnitude[e] = Magnitude::from(r[e]);
+		if (sparseB)
+			verify_sparse_multiply_add<Magnitude>(sparse_view<T>(sparseB), rMagnitude.data() + (size_t)bColStart * rounds, yMagnitude.data() + (size_t)bRowStart * rounds, rounds);
+		else
+			verify_multiply_add<Magnitude>(B, bRows, bCols, rMagnitude.data() + (size_t)bColStart * rounds, yMagnitude.data() + (size_t)bRowStart * rounds, rounds, pool);
+		if (comm != MPI_COMM_NULL)
+			MPI_Allreduce(MPI_IN_PLACE, yMagnitude.data(), (int)yMagnitude.size(), MPI_DOUBLE, mpi_op_of(Magnitude::reduction), comm);
+		verify_multiply_add<Magnitude>(A, rows, aCols, yMagnitude.data() + (size_t)aColStart * rounds, sidesMagnitude.data(), rounds, pool);
+		verify_multiply_add<Magnitude>(C, rows, cCols, rMagnitude.data() + (size_t)cColStart * rounds, sidesMagnitude.data() + bounds.size(), rounds, pool);
+		if (rowComm != MPI_COMM_NULL)
+			MPI_Allreduce(MPI_IN_PLACE, sidesMagnitude.data(), (int)sidesMagnitude.size(), MPI_DOUBLE, mpi_op_of(Magnitude::reduction), rowComm);
+		for (size_t e = 0; e < bounds.size(); e++)
+			bounds[e] = tolerance * (sidesMagnitude[e] + sidesMagnitude[bounds.size() + e]);
+		if (strassen)
+		{
+			double largest = bounds.empty() ? 0 : *max_element(bounds.begin(), bounds.end());
+			if (comm != MPI_COMM_NULL)
+				MPI_Allreduce(MPI_IN_PLACE, &largest, 1, MPI_DOUBLE, MPI_MAX, comm);
+			fill(bounds.begin(), bounds.end(), largest);
+		}
+	}
 
-	for (int i = 0; i < 7; i++)
+	long long mismatches = 0, allMismatches = 0;
+	if (rowRank == 0)
+		for (size_t e = 0; e < bounds.size(); e++)
+			mismatches += !Verifier::equal(products[e], checks[e], bounds[e]);
+	if (comm != MPI_COMM_NULL)
+		MPI_Reduce(&mismatches, &allMismatches, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+	else
+		allMismatches = mismatches;
+
+	if (procRank == 0)
+	{
+		if (allMismatches == 0)
+			cout << "Freivalds check passed with " << rounds << " random vectors." << endl;
+		else
+			cout << "Freivalds check failed: " << allMismatches << " of " << (long long)settings.n1 * rounds << " elements of C R differ." << endl;
+	}
+}
+
+// Cannon on a q x q grid of the ranks (q * q <= procNum, the other ranks sit out).
+// Rank (i, j) starts with the skewed blocks A(i, i + j) and B(i + j, j), read straight from the files,
+// then multiplies and shifts A one rank left and B one rank up along its grid row and column q times
+template<typename Ring>
+void run_process_cannon(const Settings& settings, MPI_Comm comm, RunReport& report)
+{
+	typedef typename Ring::Element T;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	int q = 1;
+	while ((q + 1) * (q + 1) <= procNum)
+		q++;
+	if (procRank == 0 && q * q != procNum)
+		cout << "Cannon needs a square number of processes, " << procNum - q * q << " of them stay idle." << endl;
+
+	int dims[2] = { q, q }, coords[2];
+	MPI_Comm grid, rowComm, colComm;
+	if (!create_grid(comm, dims, coords, grid, rowComm, colComm))
+		return;
+
+	MPI_Status status;
+	Arena arena;
+	ThreadPool pool(settings.threads < 0 ? 1 : settings.threads);
+	MPI_Datatype dataType = mpi_type_of<T>();
+	int aSource, aDestination, bSource, bDestination;
+	MPI_Cart_shift(grid, 1, -1, &aSource, &aDestination);
+	MPI_Cart_shift(grid, 0, -1, &bSource, &bDestination);
+
+	int n1 = settings.n1, n2 = settings.n2, n3 = settings.n3;
+	int i = coords[0], j = coords[1];
+	int rowStart = block_start(i, n1, q), rows = block_size(i, n1, q);
+	int colStart = block_start(j, n3, q), cols = block_size(j, n3, q);
+	int maxK = block_size(0, n2, q);
+
+	Matrix<T> A(arena, rows, maxK);
+	Matrix<T> Anext(arena, rows, maxK);
+	Matrix<T> B(arena, maxK, cols);
+	Matrix<T> Bnext(arena, maxK, cols);
+	Matrix<typename Ring::Result> result(arena, j == 0 ? (i == 0 && settings.gather ? n1 : rows) : rows, j == 0 ? n3 : cols);
+	Matrix<typename Ring::Result> C = result.view(0, 0, rows, cols);
+
+	int k = (i + j) % q;
+	int kStart = block_start(k, n2, q), kSize = block_size(k, n2, q);
+	Matrix<T> ownA(A.data(), rows, kSize, kSize);
+	Matrix<T> ownB(B.data(), kSize, cols, cols);
+	if (!load_operand(settings, 1, ownA, n1, n2, rowStart, rowStart + rows - 1, kStart, kStart + kSize - 1, grid)
+		|| !load_operand(settings, 2, ownB, n2, n3, kStart, kStart + kSize - 1, colStart, colStart + cols - 1, grid))
+	{
+		report.error = "can't read the operands";
+		MPI_Comm_free(&rowComm);
+		MPI_Comm_free(&colComm);
+		MPI_Comm_free(&grid);
+		return;
+	}
+	normalize_matrix<Ring>(ownA);
+	normalize_matrix<Ring>(ownB);
+
+	// a repetition goes on from the blocks the previous one ended with
+	MPI_Request requests[4];
+	long long sentBytes = 0;
+	int firstBlock = (i + j) % q;
+	for (int repetition = 0; repetition < repetition_count(settings); repetition++)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 4, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 2, i + 2, MPI_COMM_WORLD, &status);
+		if (settings.benchmark > 0)
+			MPI_Barrier(grid);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
 
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+		C.fill(Ring::zero());
+		for (int step = 0; step < q; step++)
+		{
+			int block = (firstBlock + step) % q;
+			int blockK = block_size(block, n2, q);
+			int nextBlockK = block_size((block + 1) % q, n2, q);
+			bool passOn = step < q - 1;
+			Matrix<T> blockA(A.data(), rows, blockK, blockK);
+			Matrix<T> blockB(B.data(), blockK, cols, cols);
+
+			if (passOn && settings.pipeline)
+			{
+				MPI_Irecv(Anext.data(), rows * nextBlockK, dataType, aSource, TAG_SHIFT_A, grid, &requests[0]);
+				MPI_Irecv(Bnext.data(), nextBlockK * cols, dataType, bSource, TAG_SHIFT_B, grid, &requests[1]);
+				MPI_Isend(A.data(), rows * blockK, dataType, aDestination, TAG_SHIFT_A, grid, &requests[2]);
+				MPI_Isend(B.data(), blockK * cols, dataType, bDestination, TAG_SHIFT_B, grid, &requests[3]);
+			}
+
+			{
+				TraceScope trace("multiply", step);
+				part_of_matrix_multiply_add<Ring>(blockA, blockB, C, rows, blockK, cols, 0, 0, pool, settings.tileRows, settings.tileCols);
+			}
+
+			if (!passOn)
+				break;
+
+			TraceScope trace(settings.pipeline ? "wait shift" : "shift A and B", step);
+			if (settings.pipeline)
+				MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+			else
+			{
+				MPI_Sendrecv(A.data(), rows * blockK, dataType, aDestination, TAG_SHIFT_A,
+					Anext.data(), rows * nextBlockK, dataType, aSource, TAG_SHIFT_A, grid, &status);
+				MPI_Sendrecv(B.data(), blockK * cols, dataType, bDestination, TAG_SHIFT_B,
+					Bnext.data(), nextBlockK * cols, dataType, bSource, TAG_SHIFT_B, grid, &status);
+			}
+			swap(A, Anext);
+			swap(B, Bnext);
+			sentBytes += ((long long)rows * blockK + (long long)blockK * cols) * sizeof(T);
+		}
+		firstBlock = (firstBlock + q - 1) % q;
+
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		record_repetition(settings, report, repetition, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), grid);
 	}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(3, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+	if (settings.benchmark > 0)
+	{
+		MPI_Allreduce(&sentBytes, &report.bytesMoved, 1, MPI_LONG_LONG, MPI_SUM, grid);
+		report.bytesMoved /= repetition_count(settings);
+	}
+	else
+	{
+		// A and B hold the blocks of the last shift, which share the inner block firstBlock
+		if (settings.verify > 0)
+		{
+			kStart = block_start(firstBlock, n2, q);
+			kSize = block_size(firstBlock, n2, q);
+			Matrix<T> heldA(A.data(), rows, kSize, kSize);
+			Matrix<T> heldB(B.data(), kSize, cols, cols);
+			verify_product<Ring>(settings, heldA, kStart, kSize, heldB, nullptr, kStart, kSize, colStart, cols, C, colStart, cols, rows, grid, rowComm, pool);
+		}
 
-	print_matrix_to_file("proc_3.txt", C, N1 / 8, N3 / 8);
+		{
+			TraceScope trace("write proc file");
+			char procFileName[MAX_NAME_LENGTH];
+			snprintf(procFileName, MAX_NAME_LENGTH, "proc_%d.txt", procRank);
+			print_matrix_to_file(procFileName, C, rows, cols);
+		}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+		write_grid_blocks(settings, result, n1, n3, rowStart, rows, dims, coords, rowComm, colComm, pool);
+	}
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+	MPI_Comm_free(&rowComm);
+	MPI_Comm_free(&colComm);
+	MPI_Comm_free(&grid);
 }
 
-template<typename T>
-void run_process_4(char** fileNames)
+// SUMMA on a pr x pc grid of all the ranks (MPI_Dims_create). Rank (i, j) holds A(i, j), B(i, j) and C(i, j).
+// The inner dimension is walked in panels that lie inside one A column block and one B row block;
+// each panel of A is broadcast along the grid rows and each panel of B along the grid columns.
+// With pipelining the broadcasts of the next panel run while the current one is multiplied
+template<typename Ring>
+void run_process_summa(const Settings& settings, MPI_Comm comm, RunReport& report)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	typedef typename Ring::Element T;
+	int procNum, procRank;
+	MPI_Comm_size(comm, &procNum);
+	MPI_Comm_rank(comm, &procRank);
+
+	int dims[2] = { 0, 0 }, coords[2];
+	MPI_Dims_create(procNum, 2, dims);
+	MPI_Comm grid, rowComm, colComm;
+	if (!create_grid(comm, dims, coords, grid, rowComm, colComm))
+		return;
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+	Arena arena;
+	ThreadPool pool(settings.threads < 0 ? 1 : settings.threads);
+	MPI_Datatype dataType = mpi_type_of<T>();
+
+	int n1 = settings.n1, n2 = settings.n2, n3 = settings.n3;
+	int i = coords[0], j = coords[1];
+	int rowStart = block_start(i, n1, dims[0]), rows = block_size(i, n1, dims[0]);
+	int colStart = block_start(j, n3, dims[1]), cols = block_size(j, n3, dims[1]);
+	int aColStart = block_start(j, n2, dims[1]), aCols = block_size(j, n2, dims[1]);
+	int bRowStart = block_start(i, n2, dims[0]), bRows = block_size(i, n2, dims[0]);
+
+	// panel bounds are the block bounds of both splits of the inner dimension
+	vector<int> bounds;
+	for (int t = 0; t <= dims[1]; t++)
+		bounds.push_back(block_start(t, n2, dims[1]));
+	for (int t = 0; t <= dims[0]; t++)
+		bounds.push_back(block_start(t, n2, dims[0]));
+	sort(bounds.begin(), bounds.end());
+	bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+	int panels = (int)bounds.size() - 1, maxWidth = 0;
+	for (int s = 0; s < panels; s++)
+		maxWidth = max(maxWidth, bounds[s + 1] - bounds[s]);
+
+	Matrix<T> A(arena, rows, aCols);
+	Matrix<T> B(arena, bRows, cols);
+	Matrix<T> panelA[2] = { Matrix<T>(arena, rows, maxWidth), Matrix<T>(arena, rows, maxWidth) };
+	Matrix<T> panelB[2] = { Matrix<T>(arena, maxWidth, cols), Matrix<T>(arena, maxWidth, cols) };
+	Matrix<typename Ring::Result> result(arena, j == 0 ? (i == 0 && settings.gather ? n1 : rows) : rows, j == 0 ? n3 : cols);
+	Matrix<typename Ring::Result> C = result.view(0, 0, rows, cols);
+
+	if (!load_operand(settings, 1, A, n1, n2, rowStart, rowStart + rows - 1, aColStart, aColStart + aCols - 1, grid)
+		|| !load_operand(settings, 2, B, n2, n3, bRowStart, bRowStart + bRows - 1, colStart, colStart + cols - 1, grid))
+	{
+		report.error = "can't read the operands";
+		MPI_Comm_free(&rowComm);
+		MPI_Comm_free(&colComm);
+		MPI_Comm_free(&grid);
+		return;
+	}
+	normalize_matrix<Ring>(A);
+	normalize_matrix<Ring>(B);
 
-	int sizeB = N2 * (N3 / 8);
+	// the owners broadcast straight from their blocks (a vector type picks the panel columns out of A),
+	// the other ranks receive into panel buffer `buffer`; without requests the broadcasts are blocking
+	long long receivedBytes = 0;
+	auto broadcast_panel = [&](int panel, int buffer, MPI_Request* requests)
+	{
+		int k = bounds[panel], width = bounds[panel + 1] - k;
+		int aOwner = block_index(k, n2, dims[1]), bOwner = block_index(k, n2, dims[0]);
+		receivedBytes += ((j != aOwner ? (long long)rows * width : 0) + (i != bOwner ? (long long)width * cols : 0)) * sizeof(T);
+
+		MPI_Datatype aType = dataType;
+		void* aBuffer = panelA[buffer].data();
+		int aCount = rows * width;
+		if (j == aOwner)
+		{
+			MPI_Type_vector(rows, width, aCols, dataType, &aType);
+			MPI_Type_commit(&aType);
+			aBuffer = A.data() + (k - aColStart);
+			aCount = 1;
+		}
+		void* bBuffer = i == bOwner ? (void*)B[k - bRowStart] : (void*)panelB[buffer].data();
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 3, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 4 * (N1 / 8), 5 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 5, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 3, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 4 * (N3 / 8), 5 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 5, 1, MPI_COMM_WORLD);
+		if (requests != nullptr)
+		{
+			MPI_Ibcast(aBuffer, aCount, aType, aOwner, rowComm, &requests[0]);
+			MPI_Ibcast(bBuffer, width * cols, dataType, bOwner, colComm, &requests[1]);
+		}
+		else
+		{
+			MPI_Bcast(aBuffer, aCount, aType, aOwner, rowComm);
+			MPI_Bcast(bBuffer, width * cols, dataType, bOwner, colComm);
+		}
+		if (aType != dataType)
+			MPI_Type_free(&aType);
+	};
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+	MPI_Request requests[2][2];
+	for (int repetition = 0; repetition < repetition_count(settings); repetition++)
+	{
+		if (settings.benchmark > 0)
+			MPI_Barrier(grid);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		C.fill(Ring::zero());
+		if (settings.pipeline && panels > 0)
+			broadcast_panel(0, 0, requests[0]);
+		for (int panel = 0; panel < panels; panel++)
+		{
+			int buffer = panel % 2;
+			{
+				TraceScope trace(settings.pipeline ? "wait panel" : "broadcast panel", panel);
+				if (settings.pipeline)
+				{
+					MPI_Waitall(2, requests[buffer], MPI_STATUSES_IGNORE);
+					if (panel + 1 < panels)
+						broadcast_panel(panel + 1, 1 - buffer, requests[1 - buffer]);
+				}
+				else
+					broadcast_panel(panel, buffer, nullptr);
+			}
+
+			TraceScope trace("multiply", panel);
+			int k = bounds[panel], width = bounds[panel + 1] - k;
+			Matrix<T> blockA = j == block_index(k, n2, dims[1]) ? A.view(0, k - aColStart, rows, width) : Matrix<T>(panelA[buffer].data(), rows, width, width);
+			Matrix<T> blockB = i == block_index(k, n2, dims[0]) ? B.view(k - bRowStart, 0, width, cols) : Matrix<T>(panelB[buffer].data(), width, cols, cols);
+			part_of_matrix_multiply_add<Ring>(blockA, blockB, C, rows, width, cols, 0, 0, pool, settings.tileRows, settings.tileCols);
+		}
 
-	for (int i = 0; i < 7; i++)
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		record_repetition(settings, report, repetition, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), grid);
+	}
+
+	if (settings.benchmark > 0)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 5, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 3, i + 2, MPI_COMM_WORLD, &status);
-		
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+		MPI_Allreduce(&receivedBytes, &report.bytesMoved, 1, MPI_LONG_LONG, MPI_SUM, grid);
+		report.bytesMoved /= repetition_count(settings);
 	}
+	else
+	{
+		if (settings.verify > 0)
+			verify_product<Ring>(settings, A, aColStart, aCols, B, nullptr, bRowStart, bRows, colStart, cols, C, colStart, cols, rows, grid, rowComm, pool);
+
+		{
+			TraceScope trace("write proc file");
+			char procFileName[MAX_NAME_LENGTH];
+			snprintf(procFileName, MAX_NAME_LENGTH, "proc_%d.txt", procRank);
+			print_matrix_to_file(procFileName, C, rows, cols);
+		}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(4, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+		write_grid_blocks(settings, result, n1, n3, rowStart, rows, dims, coords, rowComm, colComm, pool);
+	}
 
-	print_matrix_to_file("proc_4.txt", C, N1 / 8, N3 / 8);
+	MPI_Comm_free(&rowComm);
+	MPI_Comm_free(&colComm);
+	MPI_Comm_free(&grid);
+}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+// functions
+Settings load_settings()
+{
+	Settings settings;
+	settings.fileNames = Matrix<char>(SETTINGS_COUNT, MAX_NAME_LENGTH);
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+	ifstream fin;
+	fin.open(SETTINGS_FILE_NAME);
+	for (int i = 0; i < SETTINGS_COUNT; i++)
+		fin >> settings.fileNames[i];
+
+	string key;
+	while (fin >> key)
+	{
+		if (key == "pipeline")
+			fin >> settings.pipeline;
+		else if (key == "gather")
+			fin >> settings.gather;
+		else if (key == "threads")
+			fin >> settings.threads;
+		else if (key == "tile_rows")
+			fin >> settings.tileRows;
+		else if (key == "tile_cols")
+			fin >> settings.tileCols;
+		else if (key == "strassen")
+			fin >> settings.strassen;
+		else if (key == "strassen_cutoff")
+			fin >> settings.strassenCutoff;
+		else if (key == "ring")
+			fin >> settings.ring;
+		else if (key == "modulus")
+			fin >> settings.modulus;
+		else if (key == "benchmark")
+			fin >> settings.benchmark;
+		else if (key == "warmup")
+			fin >> settings.warmup;
+		else if (key == "bench_shapes")
+			fin >> settings.benchShapes;
+		else if (key == "bench_types")
+			fin >> settings.benchTypes;
+		else if (key == "bench_modes")
+			fin >> settings.benchModes;
+		else if (key == "bench_ranks")
+			fin >> settings.benchRanks;
+		else if (key == "bench_output")
+			fin >> settings.benchOutput;
+		else if (key == "trace")
+			fin >> settings.trace;
+		else if (key == "batch")
+			fin >> settings.batch;
+		else if (key == "serve")
+			fin >> settings.serve;
+		else if (key == "cache_mb")
+			fin >> settings.cacheMegabytes;
+		else if (key == "sparse_threshold")
+			fin >> settings.sparseThreshold;
+		else if (key == "narrow_ratio")
+			fin >> settings.narrowRatio;
+		else if (key == "memory_mb")
+			fin >> settings.memoryMegabytes;
+		else if (key == "verify")
+			fin >> settings.verify;
+		else if (key == "verify_tolerance")
+			fin >> settings.verifyTolerance;
+		else if (key == "n1")
+			fin >> settings.n1;
+		else if (key == "n2")
+			fin >> settings.n2;
+		else if (key == "n3")
+			fin >> settings.n3;
+		else
+		{
+			string value;
+			fin >> value;
+			cout << "Unknown setting '" << key << "' ignored." << endl;
+		}
+	}
+	fin.close();
+
+	if (!is_ring_name(settings.ring))
+	{
+		cout << "Unknown ring '" << settings.ring << "', using " << RING_PLUS_TIMES << "." << endl;
+		settings.ring = RING_PLUS_TIMES;
+	}
+	if (settings.ring == RING_MODULAR && (settings.modulus < 2 || settings.modulus >= MAX_MODULUS))
+	{
+		cout << "The modulus must be at least 2 and below 2^31, using " << DEFAULT_MODULUS << "." << endl;
+		settings.modulus = DEFAULT_MODULUS;
+	}
+	if (settings.narrowRatio > 1)
+	{
+		cout << "The narrow ratio must be at most 1, using " << NARROW_RATIO << "." << endl;
+		settings.narrowRatio = NARROW_RATIO;
+	}
+	if (settings.verify > 0 && (!settings.batch.empty() || !settings.serve.empty() || !strcmp(settings.fileNames[4], "stream")))
+	{
+		cout << "The Freivalds check needs the operands and C of a product held together, which batch, server and stream modes "
+			"don't do; verify is ignored." << endl;
+		settings.verify = 0;
+	}
+
+	return settings;
 }
 
-template<typename T>
-void run_process_5(char** fileNames)
+bool is_ring_name(const string& name)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	return name == RING_PLUS_TIMES || name == RING_MODULAR || name == RING_WRAPPING64 || name == RING_MIN_PLUS || name == RING_MAX_PLUS;
+}
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+// plus-times multiplies the elements of the element type setting, the other rings fix their own
+void run_process_in_ring(const Settings& settings, bool isSync, MPI_Comm comm, RunReport& report)
+{
+	const char* type = settings.fileNames[0];
+	if (settings.ring == RING_MODULAR)
+	{
+		ModularRing::set_modulus(settings.modulus);
+		run_process<ModularRing>(settings, isSync, comm, report);
+	}
+	else if (settings.ring == RING_WRAPPING64)
+		run_process<Wrapping64Ring>(settings, isSync, comm, report);
+	else if (settings.ring == RING_MIN_PLUS)
+		run_process<MinPlusSemiring>(settings, isSync, comm, report);
+	else if (settings.ring == RING_MAX_PLUS)
+		run_process<MaxPlusSemiring>(settings, isSync, comm, report);
+	else if (!strcmp(type, "real"))
+		run_process<PlusTimesRing<double>>(settings, isSync, comm, report);
+	else if (!strcmp(type, "float"))
+		run_process<PlusTimesRing<float>>(settings, isSync, comm, report);
+	else if (!strcmp(type, "int64"))
+		run_process<Wrapping64Ring>(settings, isSync, comm, report);
+	else if (!strcmp(type, "int16"))
+		run_process<PlusTimesRing<int16_t>>(settings, isSync, comm, report);
+	else if (!strcmp(type, "int8"))
+		run_process<PlusTimesRing<int8_t>>(settings, isSync, comm, report);
+	else
+		run_process<PlusTimesRing<int>>(settings, isSync, comm, report);
+}
 
-	int sizeB = N2 * (N3 / 8);
+// fills the dimensions missing from appsettings.txt from the matrix files
+// and checks that the inner dimensions of A and B agree
+bool resolve_dimensions(Settings& settings)
+{
+	if (settings.n1 <= 0 || settings.n2 <= 0)
+	{
+		int height, width;
+		read_matrix_dimensions(settings.fileNames[1], height, width);
+		if (settings.n1 <= 0)
+			settings.n1 = height;
+		if (settings.n2 <= 0)
+			settings.n2 = width;
+	}
+	if (settings.n3 <= 0)
+	{
+		int height, width;
+		read_matrix_dimensions(settings.fileNames[2], height, width);
+		if (height != settings.n2)
+		{
+			cout << "Matrix " << settings.fileNames[2] << " has " << height << " rows, expected " << settings.n2 << "." << endl;
+			return false;
+		}
+		settings.n3 = width;
+	}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 4, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 5 * (N1 / 8), 6 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 6, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 4, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 5 * (N3 / 8), 6 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 6, 1, MPI_COMM_WORLD);
+	if (settings.n1 <= 0 || settings.n2 <= 0 || settings.n3 <= 0)
+	{
+		cout << "Can't determine the matrix dimensions, set n1, n2 and n3 in " << SETTINGS_FILE_NAME << "." << endl;
+		return false;
+	}
+	return true;
+}
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+// the text format holds one matrix row per line with the elements separated by spaces
+void read_matrix_dimensions(const char* fileName, int& height, int& width)
+{
+	height = 0;
+	width = 0;
 
-	for (int i = 0; i < 7; i++)
+	MatrixFileHeader header;
+	if (read_matrix_file_header(fileName, header))
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 6, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 4, i + 2, MPI_COMM_WORLD, &status);
-		
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+		height = (int)header.height;
+		width = (int)header.width;
+		return;
 	}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(5, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+	read_text_matrix_dimensions(fileName, height, width);
+}
 
-	print_matrix_to_file("proc_5.txt", C, N1 / 8, N3 / 8);
+MPI_Datatype mpi_type_of_element(uint32_t elementType)
+{
+	switch (elementType)
+	{
+	case ELEMENT_INT8:
+		return MPI_SIGNED_CHAR;
+	case ELEMENT_INT16:
+		return MPI_SHORT;
+	case ELEMENT_INT32:
+		return MPI_INT;
+	case ELEMENT_INT64:
+		return MPI_LONG_LONG;
+	case ELEMENT_FLOAT32:
+		return MPI_FLOAT;
+	default:
+		return MPI_DOUBLE;
+	}
+}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+// every case of the sweep runs on the first `ranks` ranks of MPI_COMM_WORLD (sync on rank 0 alone) while
+// the other ranks wait; rank 0 prints a line per case and writes the results file. The shape, type, ring
+// and mode of each case are set in `settings` itself
+void run_benchmark(Settings& settings)
+{
+	int procNum, procRank;
+	MPI_Comm_size(MPI_COMM_WORLD, &procNum);
+	MPI_Comm_rank(MPI_COMM_WORLD, &procRank);
+
+	vector<string> shapes = split_list(settings.benchShapes);
+	vector<string> types = split_list(settings.benchTypes);
+	vector<string> modes = split_list(settings.benchModes);
+	vector<string> rankCounts = split_list(settings.benchRanks);
+	if (shapes.empty())
+		shapes.push_back(to_string(settings.n1) + "x" + to_string(settings.n2) + "x" + to_string(settings.n3));
+	if (types.empty())
+		types.push_back(settings.ring != RING_PLUS_TIMES ? settings.ring : string(settings.fileNames[0]));
+	if (modes.empty())
+		modes.push_back(settings.fileNames[4]);
+	if (rankCounts.empty())
+		rankCounts.push_back(to_string(procNum));
+
+	vector<BenchmarkResult> results;
+	for (const string& shape : shapes)
+		for (const string& type : types)
+			for (const string& mode : modes)
+				for (const string& rankCount : rankCounts)
+				{
+					if (!parse_shape(shape, settings.n1, settings.n2, settings.n3))
+					{
+						if (procRank == 0 && &type == &types[0] && &mode == &modes[0] && &rankCount == &rankCounts[0])
+							cout << "Bad benchmark shape '" << shape << "' skipped." << endl;
+						continue;
+					}
+
+					// an item of the type list is either a ring or an element type multiplied in plus-times
+					bool isSync = mode == "sync";
+					settings.ring = is_ring_name(type) ? type : RING_PLUS_TIMES;
+					if (!is_ring_name(type))
+						snprintf(settings.fileNames[0], MAX_NAME_LENGTH, "%s", type.c_str());
+					snprintf(settings.fileNames[4], MAX_NAME_LENGTH, "%s", mode.c_str());
+					int ranks = isSync ? 1 : atoi(rankCount.c_str());
+					if (isSync && &rankCount != &rankCounts[0])
+						continue;
+					if (ranks < 1 || ranks > procNum)
+					{
+						if (procRank == 0)
+							cout << "Benchmark on " << rankCount << " processes skipped, " << procNum << " are running." << endl;
+						continue;
+					}
+
+					BenchmarkResult result = {};
+					result.type = type;
+					result.ring = settings.ring;
+					result.mode = mode;
+					result.ranks = ranks;
+					result.threads = settings.threads > 0 ? settings.threads : (isSync || settings.threads == 0 ? (int)thread::hardware_concurrency() : 1);
+					result.n1 = settings.n1;
+					result.n2 = settings.n2;
+					result.n3 = settings.n3;
+					result.floating = type == "real" || type == "float" || type == RING_MIN_PLUS || type == RING_MAX_PLUS;
+
+					MPI_Comm comm;
+					MPI_Comm_split(MPI_COMM_WORLD, procRank < ranks ? 0 : MPI_UNDEFINED, procRank, &comm);
+					if (comm != MPI_COMM_NULL)
+					{
+						RunReport report;
+						run_process_in_ring(settings, isSync, comm, report);
+						result.seconds = report.seconds;
+						result.bytesMoved = report.bytesMoved;
+						MPI_Comm_free(&comm);
+					}
+					MPI_Barrier(MPI_COMM_WORLD);
+
+					if (procRank == 0)
+					{
+						BenchmarkSummary summary = summarize_benchmark(result);
+						cout << "Benchmark " << type << " " << mode << " " << ranks << " processes " << shape << ": min " << summary.min
+							<< " s, median " << summary.median << " s, p95 " << summary.p95 << " s, " << summary.opsPerSecond
+							<< (result.floating ? " GFLOP/s, " : " GOP/s, ") << result.bytesMoved << " bytes moved." << endl;
+						results.push_back(result);
+					}
+				}
+
+	if (procRank == 0 && !write_benchmark_results(settings.benchOutput.c_str(), results))
+		cout << "Can't write benchmark results " << settings.benchOutput << "." << endl;
+}
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+// one repetition only, unless benchmarking
+int repetition_count(const Settings& settings)
+{
+	return settings.benchmark > 0 ? settings.warmup + settings.benchmark : 1;
 }
 
-template<typename T>
-void run_process_6(char** fileNames)
+// a plain run prints the time of each rank; a benchmark keeps the timed repetitions, each as the time
+// of the slowest rank of comm (MPI_COMM_NULL for sync), on every rank
+void record_repetition(const Settings& settings, RunReport& report, int repetition, long long nanoseconds, MPI_Comm comm)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	int procRank = 0;
+	if (comm != MPI_COMM_NULL)
+		MPI_Comm_rank(comm, &procRank);
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+	if (settings.benchmark == 0)
+	{
+		print_time(procRank, nanoseconds, comm == MPI_COMM_NULL);
+		return;
+	}
+	if (repetition < settings.warmup)
+		return;
 
-	int sizeB = N2 * (N3 / 8);
+	long long slowest = nanoseconds;
+	if (comm != MPI_COMM_NULL)
+		MPI_Allreduce(&nanoseconds, &slowest, 1, MPI_LONG_LONG, MPI_MAX, comm);
+	report.seconds.push_back(slowest / 1e9);
+}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 5, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 6 * (N1 / 8), 7 * (N1 / 8) - 1, 0, N2 - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 7, 0, MPI_COMM_WORLD);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 5, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 6 * (N3 / 8), 7 * (N3 / 8) - 1);
-	MPI_Send(goFlag, 1, MPI_CHAR, 7, 1, MPI_COMM_WORLD);
+// batch mode: the jobs of the manifest run in one MPI session on all ranks. Rank 0 takes the dimensions of every
+// job from its files and skips the jobs whose A and B don't fit together; runs of consecutive jobs of one
+// element type then go through the ring together, the I/O of each job overlapping its neighbours' multiplies
+void run_batch(Settings& settings)
+{
+	int procRank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &procRank);
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+	vector<BatchJob> jobs;
+	if (!read_batch_manifest(settings.batch.c_str(), jobs))
+	{
+		if (procRank == 0)
+			cout << "Can't read batch manifest " << settings.batch << "." << endl;
+		return;
+	}
+	// any other mode (async, ring, none) runs on the ring anyway
+	const char* mode = settings.fileNames[4];
+	bool dropped = !strcmp(mode, "sync") || !strcmp(mode, "cannon") || !strcmp(mode, "summa") || !strcmp(mode, "stream");
+	if (procRank == 0 && dropped)
+		cout << "Batch mode multiplies on the ring, mode " << settings.fileNames[4] << " is ignored." << endl;
+
+	vector<int> dims(jobs.size() * 3);
+	if (procRank == 0)
+		for (size_t k = 0; k < jobs.size(); k++)
+		{
+			int heightA, widthA, heightB, widthB;
+			read_matrix_dimensions(jobs[k].fileNames[0].c_str(), heightA, widthA);
+			read_matrix_dimensions(jobs[k].fileNames[1].c_str(), heightB, widthB);
+			if (heightA <= 0 || widthA <= 0 || widthB <= 0 || widthA != heightB)
+			{
+				cout << "Batch job " << jobs[k].fileNames[0] << " x " << jobs[k].fileNames[1] << " skipped: can't determine matching dimensions." << endl;
+				continue;
+			}
+			dims[k * 3] = heightA;
+			dims[k * 3 + 1] = widthA;
+			dims[k * 3 + 2] = widthB;
+		}
+	MPI_Bcast(dims.data(), (int)dims.size(), MPI_INT, 0, MPI_COMM_WORLD);
+
+	vector<BatchJob> valid;
+	for (size_t k = 0; k < jobs.size(); k++)
+		if (dims[k * 3] > 0)
+		{
+			jobs[k].n1 = dims[k * 3];
+			jobs[k].n2 = dims[k * 3 + 1];
+			jobs[k].n3 = dims[k * 3 + 2];
+			valid.push_back(jobs[k]);
+		}
 
-	for (int i = 0; i < 7; i++)
+	for (size_t first = 0, last; first < valid.size(); first = last)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 7, i + 2, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 5, i + 2, MPI_COMM_WORLD, &status);
+		for (last = first; last < valid.size() && valid[last].type == valid[first].type; last++)
+			;
+		settings.batchJobs.assign(valid.begin() + first, valid.begin() + last);
+		snprintf(settings.fileNames[0], MAX_NAME_LENGTH, "%s", valid[first].type.c_str());
+		RunReport report;
+		run_process_in_ring(settings, false, MPI_COMM_WORLD, report);
+	}
+	settings.batchJobs.clear();
+}
+
+// a job per line: element type and the files of A, B and C; empty lines and lines starting with # are skipped
+bool read_batch_manifest(const char* fileName, vector<BatchJob>& jobs)
+{
+	ifstream fin(fileName);
+	if (!fin.is_open())
+		return false;
 
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+	string line;
+	while (getline(fin, line))
+	{
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos || line[start] == '#')
+			continue;
+		BatchJob job;
+		istringstream sin(line);
+		if (sin >> job.type >> job.fileNames[0] >> job.fileNames[1] >> job.fileNames[2])
+			jobs.push_back(job);
+		else
+			cout << "Bad batch manifest line '" << line << "' skipped." << endl;
 	}
+	return true;
+}
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(6, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+// server mode: the ranks stay up and run the jobs dropped into the spool directory one at a time, on the ring.
+// A job is a file NAME.job with a manifest line "type A B C" (file names as seen from the server), written
+// under another name and renamed, so it is never read half written. Rank 0 takes the first job by name,
+// broadcasts it and, once C is written, leaves NAME.done with "ok <nanoseconds>" or "error <reason>", the reason
+// being the first failure of the lowest rank that couldn't read an operand or write C. A job "stop" ends the server,
+// and so does a spool directory that can't be listed (false on rank 0). Operand slabs stay in the cache of every rank
+// from job to job
+bool serve(Settings& settings)
+{
+	int procNum, procRank;
+	MPI_Comm_size(MPI_COMM_WORLD, &procNum);
+	MPI_Comm_rank(MPI_COMM_WORLD, &procRank);
 
-	print_matrix_to_file("proc_6.txt", C, N1 / 8, N3 / 8);
+	// a spool directory that is missing or can't be listed would only ever look empty, so it stops the server at once
+	bool listable = true;
+	if (procRank == 0)
+	{
+		error_code error;
+		filesystem::directory_iterator entry(settings.serve, error);
+		listable = !error;
+		if (listable)
+			cout << "Serving jobs from " << settings.serve << "." << endl;
+		else
+			cout << "Can't serve jobs from " << settings.serve << ": " << error.message() << "." << endl;
+	}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+	for (;;)
+	{
+		// rank 0 only broadcasts a job or the stop; an idle server sleeps on every rank instead of spinning in MPI
+		JobDescriptor descriptor = {};
+		string jobName;
+		if (procRank == 0 && !listable)
+			descriptor.command = SERVE_STOP;
+		else if (procRank == 0)
+			for (descriptor = next_spool_job(settings.serve, jobName); descriptor.command == SERVE_IDLE; descriptor = next_spool_job(settings.serve, jobName))
+				this_thread::sleep_for(chrono::milliseconds(SPOOL_POLL_MS));
+		MPI_Request request;
+		MPI_Ibcast(&descriptor, sizeof(descriptor), MPI_BYTE, 0, MPI_COMM_WORLD, &request);
+		int received = 0;
+		for (MPI_Test(&request, &received, MPI_STATUS_IGNORE); !received; MPI_Test(&request, &received, MPI_STATUS_IGNORE))
+			this_thread::sleep_for(chrono::milliseconds(SPOOL_POLL_MS));
+
+		if (descriptor.command == SERVE_STOP)
+			break;
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+		BatchJob job;
+		job.type = descriptor.type;
+		for (int i = 0; i < 3; i++)
+			job.fileNames[i] = descriptor.fileNames[i];
+		job.n1 = descriptor.n1;
+		job.n2 = descriptor.n2;
+		job.n3 = descriptor.n3;
+		settings.batchJobs.assign(1, job);
+		snprintf(settings.fileNames[0], MAX_NAME_LENGTH, "%s", descriptor.type);
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		RunReport report;
+		run_process_in_ring(settings, false, MPI_COMM_WORLD, report);
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+
+		int failedRank = report.error.empty() ? procNum : procRank;
+		MPI_Allreduce(MPI_IN_PLACE, &failedRank, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+		if (failedRank < procNum)
+		{
+			char error[2 * MAX_NAME_LENGTH] = {};
+			snprintf(error, sizeof(error), "%s", report.error.c_str());
+			MPI_Bcast(error, sizeof(error), MPI_CHAR, failedRank, MPI_COMM_WORLD);
+			if (procRank == 0)
+				finish_spool_job(settings.serve, jobName, "error " + string(error));
+		}
+		else if (procRank == 0)
+			finish_spool_job(settings.serve, jobName, "ok " + to_string(chrono::duration_cast<chrono::nanoseconds>(end - start).count()));
+	}
+	settings.batchJobs.clear();
+	return listable;
 }
 
-template<typename T>
-void run_process_7(char** fileNames)
+// rank 0 takes the first NAME.job of the spool directory out of it. A job that can't run is answered at once
+// and reported as idle, like an empty directory
+JobDescriptor next_spool_job(const string& directory, string& jobName)
 {
-	MPI_Status status;
-	char* goFlag = new char;
-	int dataType = typeid(T) == typeid(int) ? MPI_INT : MPI_DOUBLE;
+	JobDescriptor descriptor = {};
+	descriptor.command = SERVE_IDLE;
+
+	error_code error;
+	vector<filesystem::path> jobs;
+	for (filesystem::directory_iterator entry(directory, error), last; !error && entry != last; entry.increment(error))
+		if (entry->path().extension() == ".job")
+			jobs.push_back(entry->path());
+	if (jobs.empty())
+		return descriptor;
+	sort(jobs.begin(), jobs.end());
+
+	jobName = jobs[0].stem().string();
+	string line;
+	{
+		ifstream fin(jobs[0]);
+		getline(fin, line);
+	}
+	filesystem::remove(jobs[0], error);
 
-	T** A = create_allocated_matrix<T>(N1 / 8, N2);
-	T** B = create_allocated_matrix<T>(N2, N3 / 8);
-	T** C = create_allocated_matrix<T>(N1 / 8, N3);
+	string type, fileNames[3];
+	istringstream sin(line);
+	sin >> type;
+	if (type == "stop")
+	{
+		finish_spool_job(directory, jobName, "ok stop");
+		descriptor.command = SERVE_STOP;
+		return descriptor;
+	}
+	if (!(sin >> fileNames[0] >> fileNames[1] >> fileNames[2]) || type.size() >= MAX_NAME_LENGTH
+		|| fileNames[0].size() >= MAX_NAME_LENGTH || fileNames[1].size() >= MAX_NAME_LENGTH || fileNames[2].size() >= MAX_NAME_LENGTH)
+	{
+		finish_spool_job(directory, jobName, "error bad job line '" + line + "'");
+		return descriptor;
+	}
 
-	int sizeB = N2 * (N3 / 8);
+	int heightA, widthA, heightB, widthB;
+	read_matrix_dimensions(fileNames[0].c_str(), heightA, widthA);
+	read_matrix_dimensions(fileNames[1].c_str(), heightB, widthB);
+	if (heightA <= 0 || widthA <= 0 || widthB <= 0 || widthA != heightB)
+	{
+		finish_spool_job(directory, jobName, "error can't determine matching dimensions of " + fileNames[0] + " and " + fileNames[1]);
+		return descriptor;
+	}
 
-	MPI_Recv(goFlag, 1, MPI_CHAR, 6, 0, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[1], A, N1, N2, 7 * (N1 / 8), N1 - 1, 0, N2 - 1);
-	MPI_Recv(goFlag, 1, MPI_CHAR, 6, 1, MPI_COMM_WORLD, &status);
-	read_part_of_matrix_from_file<T>(fileNames[2], B, N2, N3, 0, N2 - 1, 7 * (N3 / 8), N3 - 1);
+	descriptor.command = SERVE_JOB;
+	descriptor.n1 = heightA;
+	descriptor.n2 = widthA;
+	descriptor.n3 = widthB;
+	snprintf(descriptor.type, MAX_NAME_LENGTH, "%s", type.c_str());
+	for (int i = 0; i < 3; i++)
+		snprintf(descriptor.fileNames[i], MAX_NAME_LENGTH, "%s", fileNames[i].c_str());
+	return descriptor;
+}
 
-	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
-	part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, 0);
+// NAME.done appears in one rename, complete
+void finish_spool_job(const string& directory, const string& jobName, const string& result)
+{
+	filesystem::path done = filesystem::path(directory) / (jobName + ".done");
+	filesystem::path temporary = filesystem::path(directory) / (jobName + ".done.tmp");
+	{
+		ofstream fout(temporary);
+		fout << result << endl;
+	}
+	error_code error;
+	filesystem::rename(temporary, done, error);
+	if (error)
+		cout << "Can't answer job " << jobName << " in " << directory << "." << endl;
+}
+
+// every rank of comm (or the only process, when comm is MPI_COMM_NULL) starts noting its phases. The trace
+// clock becomes MPI_Wtime and time 0 is the end of a barrier, or, where MPI_WTIME_IS_GLOBAL says the clocks
+// of the ranks agree, the moment rank 0 leaves the barrier
+void start_trace(const Settings& settings, MPI_Comm comm)
+{
+	if (settings.trace.empty())
+		return;
 
-	for (int i = 0; i < 7; i++)
+	TraceLog& log = trace_log();
+	log.enabled = true;
+	log.events.reserve(TRACE_RESERVE);
+	if (comm == MPI_COMM_NULL)
 	{
-		MPI_Send(&(B[0][0]), sizeB, dataType, 0, i, MPI_COMM_WORLD);
-		MPI_Recv(&(B[0][0]), sizeB, dataType, 6, i + 2, MPI_COMM_WORLD, &status);
+		log.clock = steady_seconds;
+		log.origin = log.clock();
+		return;
+	}
+
+	log.clock = [] { return MPI_Wtime(); };
+	MPI_Barrier(comm);
+	log.origin = log.clock();
+
+	int* isGlobal, flag;
+	MPI_Comm_get_attr(comm, MPI_WTIME_IS_GLOBAL, &isGlobal, &flag);
+	if (flag && *isGlobal)
+		MPI_Bcast(&log.origin, 1, MPI_DOUBLE, 0, comm);
+}
+
+// rank 0 gathers the events of all ranks of comm and writes the trace file
+void finish_trace(const Settings& settings, MPI_Comm comm)
+{
+	if (settings.trace.empty())
+		return;
 
-		part_of_matrix_multiply(A, B, C, N1 / 8, N2, N3 / 8, 0, (i + 1) * (N3 / 8));
+	trace_log().enabled = false;
+	int procNum = 1, procRank = 0;
+	if (comm != MPI_COMM_NULL)
+	{
+		MPI_Comm_size(comm, &procNum);
+		MPI_Comm_rank(comm, &procRank);
 	}
+	string events = format_trace_events(procRank);
 
-	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
-	print_time(7, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), false);
+	if (comm != MPI_COMM_NULL)
+	{
+		int size = (int)events.size();
+		vector<int> sizes(procNum), displacements(procNum);
+		MPI_Gather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, comm);
+		string all;
+		if (procRank == 0)
+		{
+			for (int i = 1; i < procNum; i++)
+				displacements[i] = displacements[i - 1] + sizes[i - 1];
+			all.resize(displacements[procNum - 1] + sizes[procNum - 1]);
+		}
+		MPI_Gatherv(events.data(), size, MPI_CHAR, &all[0], sizes.data(), displacements.data(), MPI_CHAR, 0, comm);
+		events.swap(all);
+	}
 
-	print_matrix_to_file("proc_7.txt", C, N1 / 8, N3 / 8);
+	if (procRank == 0 && !write_trace_file(settings.trace.c_str(), events))
+		cout << "Can't write trace " << settings.trace << "." << endl;
+}
 
-	MPI_Send(&(C[0][0]), (N1 / 8) * N3, dataType, 0, 200, MPI_COMM_WORLD);
+// first row (or column) of block `index` when n rows are split into `count` blocks;
+// the first n % count blocks get one extra row
+int block_start(int index, int n, int count)
+{
+	return index * (n / count) + min(index, n % count);
+}
 
-	delete_allocated_matrix<T>(A, N1 / 8);
-	delete_allocated_matrix<T>(B, N2);
-	delete_allocated_matrix<T>(C, N1 / 8);
-	delete goFlag;
+int block_size(int index, int n, int count)
+{
+	return block_start(index + 1, n, count) - block_start(index, n, count);
 }
 
-// functions
-char** load_settings()
+// the block that row (or column) k falls in, the inverse of block_start
+int block_index(int k, int n, int count)
 {
-	char** fileNames = create_matrix<char>(SETTINGS_COUNT, MAX_NAME_LENGTH);
+	int base = n / count, extra = n % count;
+	if (k < extra * (base + 1))
+		return k / (base + 1);
+	return extra + (k - extra * (base + 1)) / base;
+}
 
-	ifstream fin;
-	fin.open(SETTINGS_FILE_NAME);
-	for (int i = 0; i < SETTINGS_COUNT; i++)
-		fin >> fileNames[i];
-	fin.close();
+// periodic dims[0] x dims[1] grid over the first ranks of comm, with communicators along its rows
+// (ranked by grid column) and columns (ranked by grid row); false for the ranks left out of the grid
+bool create_grid(MPI_Comm comm, int dims[2], int coords[2], MPI_Comm& grid, MPI_Comm& rowComm, MPI_Comm& colComm)
+{
+	int periods[2] = { 1, 1 };
+	MPI_Cart_create(comm, 2, dims, periods, 0, &grid);
+	if (grid == MPI_COMM_NULL)
+		return false;
+
+	int gridRank;
+	MPI_Comm_rank(grid, &gridRank);
+	MPI_Cart_coords(grid, gridRank, 2, coords);
+
+	int keepColumns[2] = { 0, 1 }, keepRows[2] = { 1, 0 };
+	MPI_Cart_sub(grid, keepColumns, &rowComm);
+	MPI_Cart_sub(grid, keepRows, &colComm);
+	return true;
+}
 
-	return fileNames;
+MPI_Op mpi_op_of(VerifyReduction reduction)
+{
+	return reduction == VERIFY_MIN ? MPI_MIN : reduction == VERIFY_MAX ? MPI_MAX : MPI_SUM;
 }
 
 void print_time(int procRank, long long nanoseconds, bool isSync) {
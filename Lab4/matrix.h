@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// every matrix row block starts on a cache line (and on a full zmm register)
+#define MATRIX_ALIGNMENT 64
+#define ARENA_CHUNK_SIZE (64 << 20)
+#define HUGE_PAGE_SIZE (2 << 20)
+#define HUGE_PAGES_ENV_NAME "LAB4_HUGE_PAGES"
+
+// prototypes
+void* aligned_allocate(size_t bytes);
+void aligned_free(void* pointer);
+bool huge_pages_requested();
+
+// bump allocator for the matrices of one run: allocations are 64-byte aligned,
+// come from a few large chunks and are all released together with the arena.
+// With huge pages the chunks are 2 MB aligned mappings advised to the kernel as huge pages
+class Arena
+{
+public:
+	explicit Arena(bool hugePages = huge_pages_requested(), size_t chunkSize = ARENA_CHUNK_SIZE);
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t bytes);
+	// makes the whole arena available again without returning memory to the os
+	void reset();
+
+private:
+	struct Chunk
+	{
+		char* data;
+		size_t size;
+		size_t used;
+		bool mapped;
+	};
+
+	Chunk allocate_chunk(size_t bytes);
+	void free_chunk(Chunk& chunk);
+
+	std::vector<Chunk> chunks;
+	size_t chunkSize;
+	bool hugePages;
+};
+
+// dense row-major matrix with a leading dimension (distance between rows in elements).
+// It either owns aligned heap storage, borrows storage from an Arena, or is a view into another matrix
+template<typename T>
+class Matrix
+{
+public:
+	Matrix() : storage(nullptr), rows(0), cols(0), stride(0), owner(false) {}
+	Matrix(int height, int width);
+	Matrix(Arena& arena, int height, int width);
+	Matrix(T* data, int height, int width, int ld) : storage(data), rows(height), cols(width), stride(ld), owner(false) {}
+	Matrix(Matrix&& other) noexcept;
+	Matrix& operator=(Matrix&& other) noexcept;
+	Matrix(const Matrix&) = delete;
+	Matrix& operator=(const Matrix&) = delete;
+	~Matrix();
+
+	T* operator[](int i) const { return storage + (size_t)i * stride; }
+	T* data() const { return storage; }
+	int height() const { return rows; }
+	int width() const { return cols; }
+	int ld() const { return stride; }
+	size_t size() const { return (size_t)rows * cols; }
+	// rows follow each other without padding, so the matrix can go to MPI as one buffer
+	bool is_contiguous() const { return stride == cols || rows <= 1; }
+
+	Matrix view(int startH, int startW, int height, int width) const;
+	void fill_zero();
+	void fill(T value);
+
+private:
+	T* storage;
+	int rows;
+	int cols;
+	int stride;
+	bool owner;
+};
+
+// functions
+inline void* aligned_allocate(size_t bytes)
+{
+	if (bytes == 0)
+		bytes = MATRIX_ALIGNMENT;
+#if defined(_WIN32)
+	void* pointer = _aligned_malloc(bytes, MATRIX_ALIGNMENT);
+#else
+	void* pointer = nullptr;
+	if (posix_memalign(&pointer, MATRIX_ALIGNMENT, bytes) != 0)
+		pointer = nullptr;
+#endif
+	if (pointer == nullptr)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+inline void aligned_free(void* pointer)
+{
+#if defined(_WIN32)
+	_aligned_free(pointer);
+#else
+	free(pointer);
+#endif
+}
+
+inline bool huge_pages_requested()
+{
+	const char* value = getenv(HUGE_PAGES_ENV_NAME);
+	return value != nullptr && strcmp(value, "0") != 0;
+}
+
+inline Arena::Arena(bool hugePages, size_t chunkSize) : chunkSize(chunkSize), hugePages(hugePages)
+{
+}
+
+inline Arena::~Arena()
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+		free_chunk(chunks[i]);
+}
+
+inline void* Arena::allocate(size_t bytes)
+{
+	bytes = (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+
+	for (size_t i = 0; i < chunks.size(); i++)
+		if (chunks[i].size - chunks[i].used >= bytes)
+		{
+			void* pointer = chunks[i].data + chunks[i].used;
+			chunks[i].used += bytes;
+			return pointer;
+		}
+
+	Chunk chunk = allocate_chunk(bytes > chunkSize ? bytes : chunkSize);
+	chunk.used = bytes;
+	chunks.push_back(chunk);
+	return chunk.data;
+}
+
+inline void Arena::reset()
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+		chunks[i].used = 0;
+}
+
+inline Arena::Chunk Arena::allocate_chunk(size_t bytes)
+{
+	Chunk chunk = { nullptr, bytes, 0, false };
+#if !defined(_WIN32)
+	if (hugePages)
+	{
+		chunk.size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void* pointer = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pointer != MAP_FAILED)
+		{
+#ifdef MADV_HUGEPAGE
+			madvise(pointer, chunk.size, MADV_HUGEPAGE);
+#endif
+			chunk.data = (char*)pointer;
+			chunk.mapped = true;
+			return chunk;
+		}
+		chunk.size = bytes;
+	}
+#endif
+	chunk.data = (char*)aligned_allocate(bytes);
+	return chunk;
+}
+
+inline void Arena::free_chunk(Chunk& chunk)
+{
+#if !defined(_WIN32)
+	if (chunk.mapped)
+	{
+		munmap(chunk.data, chunk.size);
+		return;
+	}
+#endif
+	aligned_free(chunk.data);
+}
+
+// templates
+template<typename T>
+Matrix<T>::Matrix(int height, int width) : rows(height), cols(width), stride(width), owner(true)
+{
+	storage = (T*)aligned_allocate(size() * sizeof(T));
+	fill_zero();
+}
+
+template<typename T>
+Matrix<T>::Matrix(Arena& arena, int height, int width) : rows(height), cols(width), stride(width), owner(false)
+{
+	storage = (T*)arena.allocate(size() * sizeof(T));
+	fill_zero();
+}
+
+template<typename T>
+Matrix<T>::Matrix(Matrix&& other) noexcept : storage(other.storage), rows(other.rows), cols(other.cols), stride(other.stride), owner(other.owner)
+{
+	other.storage = nullptr;
+	other.owner = false;
+}
+
+template<typename T>
+Matrix<T>& Matrix<T>::operator=(Matrix&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (owner)
+			aligned_free(storage);
+		storage = other.storage;
+		rows = other.rows;
+		cols = other.cols;
+		stride = other.stride;
+		owner = other.owner;
+		other.storage = nullptr;
+		other.owner = false;
+	}
+	return *this;
+}
+
+template<typename T>
+Matrix<T>::~Matrix()
+{
+	if (owner)
+		aligned_free(storage);
+}
+
+template<typename T>
+Matrix<T> Matrix<T>::view(int startH, int startW, int height, int width) const
+{
+	return Matrix<T>((*this)[startH] + startW, height, width, stride);
+}
+
+// the element types multiplied here are all zero when every byte is zero
+template<typename T>
+void Matrix<T>::fill_zero()
+{
+	if (is_contiguous())
+	{
+		memset(storage, 0, size() * sizeof(T));
+		return;
+	}
+	for (int i = 0; i < rows; i++)
+		memset((*this)[i], 0, (size_t)cols * sizeof(T));
+}
+
+// for values that aren't all zero bytes (the +-inf zero of a tropical semiring)
+template<typename T>
+void Matrix<T>::fill(T value)
+{
+	for (int i = 0; i < rows; i++)
+		std::fill((*this)[i], (*this)[i] + cols, value);
+}
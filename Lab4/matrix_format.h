@@ -0,0 +1,443 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <fstream>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary matrix file: a 64 byte header followed by height * width elements stored
+// row by row (or column by column), so a rank can reach any slab by offset.
+// The checksum is FNV-1a over the element bytes in file order
+#define MATRIX_FILE_MAGIC "LMTX"
+#define MATRIX_FILE_VERSION 1
+#define MATRIX_FILE_HEADER_SIZE 64
+#define MATRIX_FILE_EXTENSION ".bin"
+#define MATRIX_FILE_FLAG_CHECKSUM 1
+#define CHECKSUM_OFFSET_BASIS 14695981039346656037ULL
+#define CHECKSUM_PRIME 1099511628211ULL
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+enum MatrixElementType : uint32_t { ELEMENT_INT32 = 1, ELEMENT_FLOAT64 = 2, ELEMENT_INT64 = 3, ELEMENT_FLOAT32 = 4, ELEMENT_INT16 = 5, ELEMENT_INT8 = 6 };
+enum MatrixLayout : uint32_t { LAYOUT_ROW_MAJOR = 0, LAYOUT_COLUMN_MAJOR = 1 };
+
+struct MatrixFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t elementType;
+	uint32_t layout;
+	uint64_t height;
+	uint64_t width;
+	uint64_t dataOffset;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t checksum;
+	uint8_t padding[8];
+};
+
+static_assert(sizeof(MatrixFileHeader) == MATRIX_FILE_HEADER_SIZE, "matrix file header must be 64 bytes");
+
+// read-only mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() : base(nullptr), length(0) {}
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* fileName);
+	void close();
+	const char* data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	const char* base;
+	size_t length;
+};
+
+// prototypes
+uint64_t checksum_bytes(const void* data, size_t bytes, uint64_t hash = CHECKSUM_OFFSET_BASIS);
+size_t element_type_size(uint32_t elementType);
+bool is_binary_file_name(const char* fileName);
+bool is_binary_matrix_file(const char* fileName);
+bool read_matrix_file_header(const char* fileName, MatrixFileHeader& header);
+bool check_matrix_file_header(const MatrixFileHeader& header, size_t fileSize);
+bool seal_matrix_file(const char* fileName);
+
+// template prototypes
+template<typename T>
+uint32_t element_type_of();
+template<typename T>
+void convert_elements(const char* source, uint32_t elementType, T* destination, size_t count);
+template<typename S, typename T>
+void convert_elements_from(const char* source, T* destination, size_t count);
+template<typename T>
+MatrixFileHeader make_matrix_file_header(int height, int width, uint32_t layout);
+template<typename T>
+bool read_matrix_file_slab(const char* fileName, T* destination, int ld, int startH, int height, int startW, int width, bool verifyChecksum);
+template<typename T>
+bool write_matrix_file(const char* fileName, const T* source, int height, int width, int ld, uint32_t layout);
+template<typename T>
+bool create_matrix_file(const char* fileName, int height, int width);
+template<typename T>
+bool write_matrix_file_slab(const char* fileName, const T* source, int ld, int startH, int height, int startW, int width);
+
+// functions
+inline bool MappedFile::open(const char* fileName)
+{
+	close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	CloseHandle(file);
+	if (mapping == nullptr)
+		return false;
+	base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	length = base != nullptr ? (size_t)fileSize.QuadPart : 0;
+	return base != nullptr;
+#else
+	int file = ::open(fileName, O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+	void* pointer = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (pointer == MAP_FAILED)
+		return false;
+	base = (const char*)pointer;
+	length = (size_t)info.st_size;
+	return true;
+#endif
+}
+
+inline void MappedFile::close()
+{
+	if (base == nullptr)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(base);
+#else
+	munmap((void*)base, length);
+#endif
+	base = nullptr;
+	length = 0;
+}
+
+inline uint64_t checksum_bytes(const void* data, size_t bytes, uint64_t hash)
+{
+	const unsigned char* byte = (const unsigned char*)data;
+	for (size_t i = 0; i < bytes; i++)
+	{
+		hash ^= byte[i];
+		hash *= CHECKSUM_PRIME;
+	}
+	return hash;
+}
+
+inline size_t element_type_size(uint32_t elementType)
+{
+	switch (elementType)
+	{
+	case ELEMENT_INT8:
+		return 1;
+	case ELEMENT_INT16:
+		return 2;
+	case ELEMENT_INT32:
+	case ELEMENT_FLOAT32:
+		return 4;
+	case ELEMENT_FLOAT64:
+	case ELEMENT_INT64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+inline bool is_binary_file_name(const char* fileName)
+{
+	size_t length = strlen(fileName), extension = strlen(MATRIX_FILE_EXTENSION);
+	return length >= extension && !strcmp(fileName + length - extension, MATRIX_FILE_EXTENSION);
+}
+
+// binary files are recognised by their magic, whatever their name
+inline bool is_binary_matrix_file(const char* fileName)
+{
+	char magic[4] = {};
+	std::ifstream fin(fileName, std::ios::binary);
+	fin.read(magic, 4);
+	return fin.gcount() == 4 && !memcmp(magic, MATRIX_FILE_MAGIC, 4);
+}
+
+inline bool read_matrix_file_header(const char* fileName, MatrixFileHeader& header)
+{
+	std::ifstream fin(fileName, std::ios::binary | std::ios::ate);
+	if (!fin)
+		return false;
+	size_t fileSize = (size_t)fin.tellg();
+	fin.seekg(0);
+	fin.read((char*)&header, sizeof(header));
+	return fin.gcount() == (std::streamsize)sizeof(header) && check_matrix_file_header(header, fileSize);
+}
+
+inline bool check_matrix_file_header(const MatrixFileHeader& header, size_t fileSize)
+{
+	if (memcmp(header.magic, MATRIX_FILE_MAGIC, 4) || header.version != MATRIX_FILE_VERSION)
+		return false;
+	if (element_type_size(header.elementType) == 0 || header.layout > LAYOUT_COLUMN_MAJOR)
+		return false;
+	return header.dataOffset + header.height * header.width * element_type_size(header.elementType) <= fileSize;
+}
+
+// computes the checksum of a file written slab by slab (see create_matrix_file) and puts it into the header,
+// reading the elements through one buffer rather than holding them
+inline bool seal_matrix_file(const char* fileName)
+{
+	std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+	MatrixFileHeader header;
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+
+	std::vector<char> buffer(WRITE_BUFFER_SIZE);
+	uint64_t remaining = header.height * header.width * element_type_size(header.elementType), hash = CHECKSUM_OFFSET_BASIS;
+	file.seekg(header.dataOffset);
+	while (remaining > 0)
+	{
+		size_t bytes = (size_t)std::min<uint64_t>(remaining, buffer.size());
+		if (!file.read(buffer.data(), bytes))
+			return false;
+		hash = checksum_bytes(buffer.data(), bytes, hash);
+		remaining -= bytes;
+	}
+
+	header.flags |= MATRIX_FILE_FLAG_CHECKSUM;
+	header.checksum = hash;
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	return (bool)file;
+}
+
+// templates
+template<typename T>
+uint32_t element_type_of()
+{
+	if (std::is_floating_point<T>::value)
+		return sizeof(T) == 4 ? ELEMENT_FLOAT32 : ELEMENT_FLOAT64;
+	switch (sizeof(T))
+	{
+	case 1:
+		return ELEMENT_INT8;
+	case 2:
+		return ELEMENT_INT16;
+	case 8:
+		return ELEMENT_INT64;
+	default:
+		return ELEMENT_INT32;
+	}
+}
+
+// elements of the file type are converted to T, so e.g. an int file can feed a real multiply
+template<typename T>
+void convert_elements(const char* source, uint32_t elementType, T* destination, size_t count)
+{
+	if (elementType == element_type_of<T>() && element_type_size(elementType) == sizeof(T))
+	{
+		memcpy(destination, source, count * sizeof(T));
+		return;
+	}
+
+	switch (elementType)
+	{
+	case ELEMENT_INT8:
+		convert_elements_from<int8_t>(source, destination, count);
+		break;
+	case ELEMENT_INT16:
+		convert_elements_from<int16_t>(source, destination, count);
+		break;
+	case ELEMENT_INT32:
+		convert_elements_from<int32_t>(source, destination, count);
+		break;
+	case ELEMENT_INT64:
+		convert_elements_from<int64_t>(source, destination, count);
+		break;
+	case ELEMENT_FLOAT32:
+		convert_elements_from<float>(source, destination, count);
+		break;
+	default:
+		convert_elements_from<double>(source, destination, count);
+		break;
+	}
+}
+
+// source holds count unaligned elements of type S
+template<typename S, typename T>
+void convert_elements_from(const char* source, T* destination, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		S value;
+		memcpy(&value, source + i * sizeof(value), sizeof(value));
+		destination[i] = (T)value;
+	}
+}
+
+// the header of a height x width file of elements T right after the header, without a checksum yet
+template<typename T>
+MatrixFileHeader make_matrix_file_header(int height, int width, uint32_t layout)
+{
+	MatrixFileHeader header = {};
+	memcpy(header.magic, MATRIX_FILE_MAGIC, 4);
+	header.version = MATRIX_FILE_VERSION;
+	header.elementType = element_type_of<T>();
+	header.layout = layout;
+	header.height = height;
+	header.width = width;
+	header.dataOffset = MATRIX_FILE_HEADER_SIZE;
+	return header;
+}
+
+// copies rows [startH, startH + height) and columns [startW, startW + width) of the file
+// into destination (row stride ld) straight from the mapping, without touching the rest of the file
+template<typename T>
+bool read_matrix_file_slab(const char* fileName, T* destination, int ld, int startH, int height, int startW, int width, bool verifyChecksum)
+{
+	MappedFile file;
+	if (!file.open(fileName) || file.size() < sizeof(MatrixFileHeader))
+		return false;
+
+	MatrixFileHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (!check_matrix_file_header(header, file.size()))
+		return false;
+	if (startH < 0 || startW < 0 || (uint64_t)(startH + height) > header.height || (uint64_t)(startW + width) > header.width)
+		return false;
+
+	size_t elementSize = element_type_size(header.elementType);
+	const char* data = file.data() + header.dataOffset;
+
+	if (verifyChecksum && (header.flags & MATRIX_FILE_FLAG_CHECKSUM))
+		if (checksum_bytes(data, header.height * header.width * elementSize) != header.checksum)
+			return false;
+
+	if (header.layout == LAYOUT_ROW_MAJOR)
+	{
+		for (int i = 0; i < height; i++)
+		{
+			const char* row = data + ((uint64_t)(startH + i) * header.width + startW) * elementSize;
+			convert_elements(row, header.elementType, destination + (size_t)i * ld, width);
+		}
+		return true;
+	}
+
+	std::vector<T> column(height);
+	for (int j = 0; j < width; j++)
+	{
+		const char* source = data + ((uint64_t)(startW + j) * header.height + startH) * elementSize;
+		convert_elements(source, header.elementType, column.data(), height);
+		for (int i = 0; i < height; i++)
+			destination[(size_t)i * ld + j] = column[i];
+	}
+	return true;
+}
+
+template<typename T>
+bool write_matrix_file(const char* fileName, const T* source, int height, int width, int ld, uint32_t layout)
+{
+	MatrixFileHeader header = make_matrix_file_header<T>(height, width, layout);
+	header.flags = MATRIX_FILE_FLAG_CHECKSUM;
+	header.checksum = CHECKSUM_OFFSET_BASIS;
+
+	std::ofstream fout(fileName, std::ios::binary);
+	if (!fout)
+		return false;
+	fout.write((const char*)&header, sizeof(header));
+
+	// elements go out in file order through one buffer, the checksum follows the same order
+	std::vector<T> buffer;
+	buffer.reserve(WRITE_BUFFER_SIZE / sizeof(T));
+	int outer = layout == LAYOUT_ROW_MAJOR ? height : width;
+	int inner = layout == LAYOUT_ROW_MAJOR ? width : height;
+	for (int o = 0; o < outer; o++)
+		for (int i = 0; i < inner; i++)
+		{
+			buffer.push_back(layout == LAYOUT_ROW_MAJOR ? source[(size_t)o * ld + i] : source[(size_t)i * ld + o]);
+			if (buffer.size() == buffer.capacity())
+			{
+				header.checksum = checksum_bytes(buffer.data(), buffer.size() * sizeof(T), header.checksum);
+				fout.write((const char*)buffer.data(), buffer.size() * sizeof(T));
+				buffer.clear();
+			}
+		}
+	header.checksum = checksum_bytes(buffer.data(), buffer.size() * sizeof(T), header.checksum);
+	fout.write((const char*)buffer.data(), buffer.size() * sizeof(T));
+
+	fout.seekp(0);
+	fout.write((const char*)&header, sizeof(header));
+	return (bool)fout;
+}
+
+// a row-major file of height x width elements, all zero, without a checksum, for write_matrix_file_slab
+// to fill slab by slab (from several processes at once, the slabs not overlapping) and seal_matrix_file to finish
+template<typename T>
+bool create_matrix_file(const char* fileName, int height, int width)
+{
+	MatrixFileHeader header = make_matrix_file_header<T>(height, width, LAYOUT_ROW_MAJOR);
+	std::ofstream fout(fileName, std::ios::binary);
+	if (!fout)
+		return false;
+	fout.write((const char*)&header, sizeof(header));
+	// the last element extends the file to its full size, the rest of it stays a hole
+	uint64_t size = header.dataOffset + (uint64_t)height * width * sizeof(T);
+	if (size > header.dataOffset)
+	{
+		fout.seekp(size - 1);
+		fout.put(0);
+	}
+	return (bool)fout;
+}
+
+// copies source (row stride ld) into rows [startH, startH + height) and columns [startW, startW + width)
+// of a row-major file of element type T
+template<typename T>
+bool write_matrix_file_slab(const char* fileName, const T* source, int ld, int startH, int height, int startW, int width)
+{
+	std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+	MatrixFileHeader header;
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+	if (header.elementType != element_type_of<T>() || element_type_size(header.elementType) != sizeof(T) || header.layout != LAYOUT_ROW_MAJOR)
+		return false;
+	if (startH < 0 || startW < 0 || (uint64_t)(startH + height) > header.height || (uint64_t)(startW + width) > header.width)
+		return false;
+
+	for (int i = 0; i < height; i++)
+	{
+		file.seekp(header.dataOffset + ((uint64_t)(startH + i) * header.width + startW) * sizeof(T));
+		file.write((const char*)(source + (size_t)i * ld), (size_t)width * sizeof(T));
+	}
+	return (bool)file;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "kernels.h"
+#include "matrix.h"
+#include "thread_pool.h"
+
+// Narrow blocks are whole numbers in a small range, like the 1..9 and 10..99 of the test matrices, sent
+// frame of reference: the smallest value once, then every element as its distance from it in just enough bits
+// (0 when all are equal). Real elements qualify when every one of them is a whole number below 2^53 (and no zero
+// is negative), so the round trip is exact. A block is only packed when that takes at most the ratio of its dense bytes
+#define NARROW_RATIO 0.75
+#define NARROW_MAX_MAGNITUDE 9007199254740992.0
+
+// the packed form: this header, then the distances as a stream of bits over 64-bit words, element e at bit e * bits
+struct NarrowHeader
+{
+	int64_t base;
+	int32_t rows;
+	int32_t cols;
+	int32_t bits;
+	int32_t reserved;
+};
+
+// prototypes
+size_t narrow_packed_size(int rows, int cols, int bits);
+
+// template prototypes
+template<typename T>
+bool narrow_range(const Matrix<T>& matrix, int64_t& base, int& bits);
+template<typename T>
+void pack_narrow(const Matrix<T>& matrix, int64_t base, int bits, char* packed);
+template<typename T>
+bool pack_if_narrow(const Matrix<T>& matrix, double ratio, std::vector<char>& packed);
+template<typename T>
+void unpack_narrow(const char* packed, Matrix<T>& matrix, ThreadPool& pool);
+
+// functions
+inline size_t narrow_packed_size(int rows, int cols, int bits)
+{
+	return sizeof(NarrowHeader) + ((size_t)rows * cols * bits + 63) / 64 * sizeof(uint64_t);
+}
+
+// templates
+// the smallest element and the bits of the largest distance from it; false for an empty matrix or a real element
+// that can't go through an int64_t unchanged
+template<typename T>
+bool narrow_range(const Matrix<T>& matrix, int64_t& base, int& bits)
+{
+	if (matrix.size() == 0)
+		return false;
+
+	int64_t low = 0, high = 0;
+	for (int i = 0; i < matrix.height(); i++)
+	{
+		const T* row = matrix[i];
+		for (int j = 0; j < matrix.width(); j++)
+		{
+			if constexpr (std::is_floating_point<T>::value)
+				if (!(std::fabs(row[j]) < NARROW_MAX_MAGNITUDE) || row[j] != std::floor(row[j]) || (row[j] == 0 && std::signbit(row[j])))
+					return false;
+			int64_t value = (int64_t)row[j];
+			if ((i == 0 && j == 0) || value < low)
+				low = value;
+			if ((i == 0 && j == 0) || value > high)
+				high = value;
+		}
+	}
+
+	uint64_t range = (uint64_t)high - (uint64_t)low;
+	base = low;
+	bits = 0;
+	while (bits < 64 && (range >> bits) != 0)
+		bits++;
+	return true;
+}
+
+// packed must hold narrow_packed_size(rows, cols, bits) bytes
+template<typename T>
+void pack_narrow(const Matrix<T>& matrix, int64_t base, int bits, char* packed)
+{
+	int rows = matrix.height(), cols = matrix.width();
+	NarrowHeader header = { base, rows, cols, bits, 0 };
+	memcpy(packed, &header, sizeof(header));
+	uint64_t* words = (uint64_t*)(packed + sizeof(header));
+	memset(words, 0, narrow_packed_size(rows, cols, bits) - sizeof(header));
+	if (bits == 0)
+		return;
+
+	size_t bit = 0;
+	for (int i = 0; i < rows; i++)
+	{
+		const T* row = matrix[i];
+		for (int j = 0; j < cols; j++, bit += bits)
+		{
+			uint64_t distance = (uint64_t)(int64_t)row[j] - (uint64_t)base;
+			size_t word = bit / 64;
+			int shift = (int)(bit % 64);
+			words[word] |= distance << shift;
+			if (shift + bits > 64)
+				words[word + 1] |= distance >> (64 - shift);
+		}
+	}
+}
+
+// packs the matrix when it is narrow enough that the packed form takes at most ratio of its dense bytes;
+// a negative ratio keeps everything dense
+template<typename T>
+bool pack_if_narrow(const Matrix<T>& matrix, double ratio, std::vector<char>& packed)
+{
+	int64_t base;
+	int bits;
+	if (ratio < 0 || !narrow_range(matrix, base, bits))
+		return false;
+
+	size_t size = narrow_packed_size(matrix.height(), matrix.width(), bits);
+	if ((double)size > ratio * matrix.size() * sizeof(T))
+		return false;
+
+	packed.resize(size);
+	pack_narrow(matrix, base, bits, packed.data());
+	return true;
+}
+
+// the packed rows x cols block back into the first rows and columns of matrix; the threads share blocks of BLOCK_MC rows
+template<typename T>
+void unpack_narrow(const char* packed, Matrix<T>& matrix, ThreadPool& pool)
+{
+	NarrowHeader header;
+	memcpy(&header, packed, sizeof(header));
+	const uint64_t* words = (const uint64_t*)(packed + sizeof(header));
+	const int bits = header.bits, cols = header.cols;
+	const uint64_t mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+
+	pool.parallel_for((header.rows + BLOCK_MC - 1) / BLOCK_MC, [&](int task)
+	{
+		for (int i = task * BLOCK_MC; i < std::min(header.rows, (task + 1) * BLOCK_MC); i++)
+		{
+			T* row = matrix[i];
+			size_t bit = (size_t)i * cols * bits;
+			for (int j = 0; j < cols; j++, bit += bits)
+			{
+				uint64_t distance = 0;
+				if (bits > 0)
+				{
+					size_t word = bit / 64;
+					int shift = (int)(bit % 64);
+					distance = words[word] >> shift;
+					if (shift + bits > 64)
+						distance |= words[word + 1] << (64 - shift);
+				}
+				row[j] = (T)(int64_t)((uint64_t)header.base + (distance & mask));
+			}
+		}
+	});
+}
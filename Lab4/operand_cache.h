@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "matrix_format.h"
+
+// Slabs of operand files that a rank keeps after loading them, so a job repeating an operand (the same B
+// against new A matrices, say) copies the slab instead of parsing the file again. A slab is known by its file,
+// the file's size and modification time (a rewritten file is loaded anew), the element type it was read as and
+// its rows and columns. The slabs of all element types share one capacity; the least recently used slabs go
+// once the cache holds more than it
+#define OPERAND_CACHE_MB 512
+
+struct OperandKey
+{
+	std::string fileName;
+	long long modified;
+	long long size;
+	uint32_t elementType;
+	int startH;
+	int height;
+	int startW;
+	int width;
+
+	bool operator==(const OperandKey& other) const
+	{
+		return modified == other.modified && size == other.size && elementType == other.elementType && startH == other.startH
+			&& height == other.height && startW == other.startW && width == other.width && fileName == other.fileName;
+	}
+};
+
+class OperandCache
+{
+public:
+	// a smaller capacity drops the least recently used slabs at once
+	void set_capacity(size_t bytes) { capacity = bytes; make_room(0); }
+	// copies a cached slab into destination (rows ld elements apart); false when the slab isn't cached
+	template<typename T>
+	bool fetch(const OperandKey& key, T* destination, int ld);
+	template<typename T>
+	void store(const OperandKey& key, const T* source, int ld);
+
+private:
+	// a slab's rows are stored one after another, width elements each
+	struct Entry
+	{
+		OperandKey key;
+		std::vector<char> slab;
+		unsigned long long used;
+	};
+
+	void make_room(size_t slabBytes);
+
+	std::vector<Entry> entries;
+	size_t bytes = 0;
+	size_t capacity = (size_t)OPERAND_CACHE_MB << 20;
+	unsigned long long clock = 0;
+};
+
+// prototypes
+bool make_operand_key(const char* fileName, uint32_t elementType, int startH, int height, int startW, int width, OperandKey& key);
+OperandCache& operand_cache();
+
+// functions
+// false when the file can't be looked at; such a slab is just loaded every time
+inline bool make_operand_key(const char* fileName, uint32_t elementType, int startH, int height, int startW, int width, OperandKey& key)
+{
+	std::error_code error;
+	std::filesystem::file_time_type modified = std::filesystem::last_write_time(fileName, error);
+	if (error)
+		return false;
+	uintmax_t size = std::filesystem::file_size(fileName, error);
+	if (error)
+		return false;
+
+	key.fileName = fileName;
+	key.modified = (long long)modified.time_since_epoch().count();
+	key.size = (long long)size;
+	key.elementType = elementType;
+	key.startH = startH;
+	key.height = height;
+	key.startW = startW;
+	key.width = width;
+	return true;
+}
+
+// one cache for all element types
+inline OperandCache& operand_cache()
+{
+	static OperandCache cache;
+	return cache;
+}
+
+// drops the least recently used slabs until slabBytes more fit the capacity
+inline void OperandCache::make_room(size_t slabBytes)
+{
+	while (!entries.empty() && bytes + slabBytes > capacity)
+	{
+		size_t oldest = 0;
+		for (size_t e = 1; e < entries.size(); e++)
+			if (entries[e].used < entries[oldest].used)
+				oldest = e;
+		bytes -= entries[oldest].slab.size();
+		entries.erase(entries.begin() + oldest);
+	}
+}
+
+// templates
+template<typename T>
+bool OperandCache::fetch(const OperandKey& key, T* destination, int ld)
+{
+	for (size_t e = 0; e < entries.size(); e++)
+		if (entries[e].key == key)
+		{
+			entries[e].used = ++clock;
+			size_t rowBytes = (size_t)key.width * sizeof(T);
+			for (int i = 0; i < key.height; i++)
+				memcpy(destination + (size_t)i * ld, entries[e].slab.data() + i * rowBytes, rowBytes);
+			return true;
+		}
+	return false;
+}
+
+template<typename T>
+void OperandCache::store(const OperandKey& key, const T* source, int ld)
+{
+	size_t rowBytes = (size_t)key.width * sizeof(T), slabBytes = key.height * rowBytes;
+	if (slabBytes > capacity)
+		return;
+	make_room(slabBytes);
+
+	Entry entry = { key, std::vector<char>(slabBytes), ++clock };
+	for (int i = 0; i < key.height; i++)
+		memcpy(entry.slab.data() + i * rowBytes, source + (size_t)i * ld, rowBytes);
+	entries.push_back(std::move(entry));
+	bytes += slabBytes;
+}
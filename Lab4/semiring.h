@@ -0,0 +1,557 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include "kernels.h"
+
+// Z_p keeps residues of a modulus below 2^31 in int elements
+#define DEFAULT_MODULUS 1000000007LL
+#define MAX_MODULUS (1LL << 31)
+#define RING_PLUS_TIMES "plus-times"
+#define RING_MODULAR "modp"
+#define RING_WRAPPING64 "wrap64"
+#define RING_MIN_PLUS "min-plus"
+#define RING_MAX_PLUS "max-plus"
+
+// A ring policy tells the multiply how to combine elements.
+// Element is what A and B hold (and what goes through the files and MPI), Result what C holds and
+// Accumulator what a micro kernel tile holds. zero() is the neutral element of add, multiply_add adds one
+// product to an accumulator and accumulate folds a finished tile value into an element of C. A kernel may
+// add at most delay() products to an accumulator before it has to fold() it back into range.
+// supportsStrassen allows Strassen-Winograd (it needs subtraction and sums of A and B that fit an Element),
+// exact says that Strassen-Winograd gives the same result
+// plus-times integers wrap around their width in every sum and product (see wrapping_add), which keeps
+// Strassen-Winograd exact for them
+template<typename T>
+struct PlusTimesRing
+{
+	typedef T Element;
+	typedef typename AccumulatorOf<T>::type Accumulator;
+	typedef Accumulator Result;
+	static const bool supportsStrassen = std::is_same<T, Result>::value;
+	static const bool exact = !std::numeric_limits<T>::is_iec559;
+	static const bool normalizes = false;
+
+	static Result zero() { return 0; }
+	static Result add(Result a, Result b) { return wrapping_add(a, b); }
+	static Result subtract(Result a, Result b) { return wrapping_subtract(a, b); }
+	static Accumulator multiply_add(Accumulator accumulator, T a, T b) { return wrapping_add(accumulator, wrapping_multiply((Accumulator)a, (Accumulator)b)); }
+	static Result accumulate(Result c, Accumulator accumulator) { return wrapping_add(c, accumulator); }
+	static Accumulator fold(Accumulator accumulator) { return accumulator; }
+	static T normalize(T value) { return value; }
+	static int delay() { return std::numeric_limits<int>::max(); }
+	static const MicroKernel<T, Accumulator>& kernel() { return active_micro_kernel<T>(); }
+};
+
+// Z_p for a prime (or any modulus) p < 2^31. Products of residues are summed exactly in 64 bits and only
+// reduced once per tile with Barrett's method; when p is large the 64-bit sums are folded every delay()
+// products (acc = hi * (2^32 mod p) + lo) so they can't overflow. Below 2^28 the kernels never fold
+struct ModularRing
+{
+	typedef int Element;
+	typedef uint64_t Accumulator;
+	typedef int Result;
+	static const bool supportsStrassen = true;
+	static const bool exact = true;
+	static const bool normalizes = true;
+
+	static bool set_modulus(long long p);
+	static uint32_t modulus() { return state().p; }
+
+	static int zero() { return 0; }
+	static int add(int a, int b) { uint32_t sum = (uint32_t)a + (uint32_t)b; return (int)(sum >= state().p ? sum - state().p : sum); }
+	static int subtract(int a, int b) { return a >= b ? a - b : (int)((uint32_t)a + state().p - (uint32_t)b); }
+	static uint64_t multiply_add(uint64_t accumulator, int a, int b) { return accumulator + (uint64_t)(uint32_t)a * (uint32_t)b; }
+	static int accumulate(int c, uint64_t accumulator) { return add(c, (int)reduce(accumulator)); }
+	static uint64_t fold(uint64_t accumulator) { return (accumulator >> 32) * state().r32 + (accumulator & 0xffffffffULL); }
+	static int normalize(int value) { long long residue = value % (long long)state().p; return (int)(residue < 0 ? residue + state().p : residue); }
+	static int delay() { return state().delay; }
+	static uint32_t fold_factor() { return state().r32; }
+	static uint64_t reduce(uint64_t x);
+	static const MicroKernel<int, uint64_t>& kernel();
+
+private:
+	struct State
+	{
+		uint32_t p;
+		// 2^32 mod p and floor((2^64 - 1) / p)
+		uint64_t r32;
+		uint64_t barrett;
+		int delay;
+	};
+	static State& state();
+};
+
+// integers modulo 2^64: the products wrap instead of overflowing, which C++ only allows on unsigned types.
+// This is also how int64 elements multiply
+struct Wrapping64Ring
+{
+	typedef long long Element;
+	typedef uint64_t Accumulator;
+	typedef long long Result;
+	static const bool supportsStrassen = true;
+	static const bool exact = true;
+	static const bool normalizes = false;
+
+	static long long zero() { return 0; }
+	static long long add(long long a, long long b) { return (long long)((uint64_t)a + (uint64_t)b); }
+	static long long subtract(long long a, long long b) { return (long long)((uint64_t)a - (uint64_t)b); }
+	static uint64_t multiply_add(uint64_t accumulator, long long a, long long b) { return accumulator + (uint64_t)a * (uint64_t)b; }
+	static long long accumulate(long long c, uint64_t accumulator) { return (long long)((uint64_t)c + accumulator); }
+	static uint64_t fold(uint64_t accumulator) { return accumulator; }
+	static long long normalize(long long value) { return value; }
+	static int delay() { return std::numeric_limits<int>::max(); }
+	static const MicroKernel<long long, uint64_t>& kernel();
+};
+
+// tropical semirings over double: "add" is min (or max), "multiply" is +, and zero is +inf (or -inf).
+// A shortest-path (or longest-path) step is one multiply of a distance matrix by itself
+template<bool MAX>
+struct TropicalSemiring
+{
+	typedef double Element;
+	typedef double Accumulator;
+	typedef double Result;
+	static const bool supportsStrassen = false;
+	static const bool exact = true;
+	static const bool normalizes = false;
+
+	static double zero() { return MAX ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity(); }
+	static double add(double a, double b) { return MAX ? (a > b ? a : b) : (a < b ? a : b); }
+	static double subtract(double a, double b) { return add(a, b); }
+	static double multiply_add(double accumulator, double a, double b) { return add(accumulator, a + b); }
+	static double accumulate(double c, double accumulator) { return add(c, accumulator); }
+	static double fold(double accumulator) { return accumulator; }
+	static double normalize(double value) { return value; }
+	static int delay() { return std::numeric_limits<int>::max(); }
+	static const MicroKernel<double>& kernel();
+};
+
+typedef TropicalSemiring<false> MinPlusSemiring;
+typedef TropicalSemiring<true> MaxPlusSemiring;
+
+// prototypes
+uint64_t multiply_high(uint64_t a, uint64_t b);
+
+// template prototypes
+template<typename Ring, int MR, int NR, int KC>
+void micro_kernel_ring_scalar(int kc, const typename Ring::Element* packedA, const typename Ring::Element* packedB, typename Ring::Accumulator* tile);
+
+// functions
+inline uint64_t multiply_high(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	return __umulh(a, b);
+#else
+	uint64_t aLow = a & 0xffffffffULL, aHigh = a >> 32, bLow = b & 0xffffffffULL, bHigh = b >> 32;
+	uint64_t middle = (aLow * bLow >> 32) + (aHigh * bLow & 0xffffffffULL) + aLow * bHigh;
+	return aHigh * bHigh + (aHigh * bLow >> 32) + (middle >> 32);
+#endif
+}
+
+inline ModularRing::State& ModularRing::state()
+{
+	static State current = {};
+	return current;
+}
+
+// the largest delay keeps a folded accumulator (below 2^32 * (p + 1)) plus delay products of residues
+// below 2^64; the kernels work through kc in chunks of delay products
+inline bool ModularRing::set_modulus(long long p)
+{
+	if (p < 2 || p >= MAX_MODULUS)
+		return false;
+
+	State& current = state();
+	current.p = (uint32_t)p;
+	current.r32 = (1ULL << 32) % (uint64_t)p;
+	current.barrett = ~0ULL / (uint64_t)p;
+	uint64_t product = (uint64_t)(p - 1) * (uint64_t)(p - 1);
+	uint64_t headroom = ~0ULL - ((uint64_t)(p + 1) << 32);
+	uint64_t delay = product == 0 ? BLOCK_KC : headroom / product;
+	current.delay = (int)(delay > BLOCK_KC ? BLOCK_KC : delay);
+	return true;
+}
+
+// Barrett: the quotient estimate is at most two short, so x - q * p < 3p
+inline uint64_t ModularRing::reduce(uint64_t x)
+{
+	const State& current = state();
+	uint64_t remainder = x - multiply_high(x, current.barrett) * current.p;
+	while (remainder >= current.p)
+		remainder -= current.p;
+	return remainder;
+}
+
+// templates
+// works for every ring policy, one multiply_add at a time; the isa kernels below do the same with vectors
+template<typename Ring, int MR, int NR, int KC>
+void micro_kernel_ring_scalar(int kc, const typename Ring::Element* packedA, const typename Ring::Element* packedB, typename Ring::Accumulator* tile)
+{
+	typedef typename Ring::Accumulator Accumulator;
+	const int depth = KC > 0 ? KC : kc;
+	const int delay = Ring::delay();
+	Accumulator acc[MR][NR];
+	for (int i = 0; i < MR; i++)
+		for (int j = 0; j < NR; j++)
+			acc[i][j] = (Accumulator)Ring::zero();
+
+	for (int k = 0; k < depth;)
+	{
+		int stop = depth - k <= delay ? depth : k + delay;
+		for (; k < stop; k++, packedA += MR, packedB += NR)
+			for (int i = 0; i < MR; i++)
+			{
+				typename Ring::Element a = packedA[i];
+				for (int j = 0; j < NR; j++)
+					acc[i][j] = Ring::multiply_add(acc[i][j], a, packedB[j]);
+			}
+		if (k < depth)
+			for (int i = 0; i < MR; i++)
+				for (int j = 0; j < NR; j++)
+					acc[i][j] = Ring::fold(acc[i][j]);
+	}
+
+	for (int i = 0; i < MR; i++)
+		for (int j = 0; j < NR; j++)
+			tile[i * NR + j] = acc[i][j];
+}
+
+#ifdef KERNELS_X86
+// Z_p kernels: every 64-bit lane holds one sum; mul_epu32 multiplies the low 32 bits of the lanes,
+// so B is widened from 32 to 64-bit lanes on load and A is broadcast as a 64-bit value
+
+template<int KC>
+TARGET_SSE4 inline void micro_kernel_modular_sse4(int kc, const int* packedA, const int* packedB, uint64_t* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	const int delay = ModularRing::delay();
+	const __m128i factor = _mm_set1_epi64x((long long)ModularRing::fold_factor());
+	const __m128i low = _mm_set1_epi64x(0xffffffffLL);
+	__m128i acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_setzero_si128();
+
+	for (int k = 0; k < depth;)
+	{
+		int stop = depth - k <= delay ? depth : k + delay;
+		for (; k < stop; k++, packedA += 4, packedB += 4)
+		{
+			__m128i b = _mm_loadu_si128((const __m128i*)packedB);
+			__m128i b0 = _mm_cvtepu32_epi64(b);
+			__m128i b1 = _mm_cvtepu32_epi64(_mm_srli_si128(b, 8));
+			for (int i = 0; i < 4; i++)
+			{
+				__m128i a = _mm_set1_epi64x((long long)(uint32_t)packedA[i]);
+				acc[i][0] = _mm_add_epi64(acc[i][0], _mm_mul_epu32(a, b0));
+				acc[i][1] = _mm_add_epi64(acc[i][1], _mm_mul_epu32(a, b1));
+			}
+		}
+		if (k < depth)
+			for (int i = 0; i < 4; i++)
+				for (int h = 0; h < 2; h++)
+					acc[i][h] = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(acc[i][h], 32), factor), _mm_and_si128(acc[i][h], low));
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_si128((__m128i*)(tile + i * 4), acc[i][0]);
+		_mm_storeu_si128((__m128i*)(tile + i * 4 + 2), acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX2 inline void micro_kernel_modular_avx2(int kc, const int* packedA, const int* packedB, uint64_t* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	const int delay = ModularRing::delay();
+	__m256i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_si256();
+
+	for (int k = 0; k < depth;)
+	{
+		int stop = depth - k <= delay ? depth : k + delay;
+		for (; k < stop; k++, packedA += 6, packedB += 8)
+		{
+			__m256i b0 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)packedB));
+			__m256i b1 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(packedB + 4)));
+			for (int i = 0; i < 6; i++)
+			{
+				__m256i a = _mm256_set1_epi64x((long long)(uint32_t)packedA[i]);
+				acc[i][0] = _mm256_add_epi64(acc[i][0], _mm256_mul_epu32(a, b0));
+				acc[i][1] = _mm256_add_epi64(acc[i][1], _mm256_mul_epu32(a, b1));
+			}
+		}
+		if (k < depth)
+		{
+			const __m256i factor = _mm256_set1_epi64x((long long)ModularRing::fold_factor());
+			const __m256i low = _mm256_set1_epi64x(0xffffffffLL);
+			for (int i = 0; i < 6; i++)
+				for (int h = 0; h < 2; h++)
+					acc[i][h] = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(acc[i][h], 32), factor), _mm256_and_si256(acc[i][h], low));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_si256((__m256i*)(tile + i * 8), acc[i][0]);
+		_mm256_storeu_si256((__m256i*)(tile + i * 8 + 4), acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX512 inline void micro_kernel_modular_avx512(int kc, const int* packedA, const int* packedB, uint64_t* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	const int delay = ModularRing::delay();
+	__m512i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_setzero_si512();
+
+	for (int k = 0; k < depth;)
+	{
+		int stop = depth - k <= delay ? depth : k + delay;
+		for (; k < stop; k++, packedA += 6, packedB += 16)
+		{
+			__m512i b0 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)packedB));
+			__m512i b1 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)(packedB + 8)));
+			for (int i = 0; i < 6; i++)
+			{
+				__m512i a = _mm512_set1_epi64((long long)(uint32_t)packedA[i]);
+				acc[i][0] = _mm512_add_epi64(acc[i][0], _mm512_mul_epu32(a, b0));
+				acc[i][1] = _mm512_add_epi64(acc[i][1], _mm512_mul_epu32(a, b1));
+			}
+		}
+		if (k < depth)
+		{
+			const __m512i factor = _mm512_set1_epi64((long long)ModularRing::fold_factor());
+			const __m512i low = _mm512_set1_epi64(0xffffffffLL);
+			for (int i = 0; i < 6; i++)
+				for (int h = 0; h < 2; h++)
+					acc[i][h] = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(acc[i][h], 32), factor), _mm512_and_si512(acc[i][h], low));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_si512(tile + i * 16, acc[i][0]);
+		_mm512_storeu_si512(tile + i * 16 + 8, acc[i][1]);
+	}
+}
+
+// wrapping 64-bit kernels: without a 64-bit mullo (AVX-512DQ) the product is put together from three
+// 32-bit products, lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32), all modulo 2^64
+
+template<int KC>
+TARGET_AVX2 inline void micro_kernel_wrapping64_avx2(int kc, const long long* packedA, const long long* packedB, uint64_t* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256i acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm256_setzero_si256();
+
+	for (int k = 0; k < depth; k++, packedA += 4, packedB += 8)
+	{
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)packedB);
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(packedB + 4));
+		__m256i b0High = _mm256_srli_epi64(b0, 32);
+		__m256i b1High = _mm256_srli_epi64(b1, 32);
+		for (int i = 0; i < 4; i++)
+		{
+			__m256i a = _mm256_set1_epi64x(packedA[i]);
+			__m256i aHigh = _mm256_set1_epi64x((long long)((uint64_t)packedA[i] >> 32));
+			__m256i cross0 = _mm256_add_epi64(_mm256_mul_epu32(aHigh, b0), _mm256_mul_epu32(a, b0High));
+			__m256i cross1 = _mm256_add_epi64(_mm256_mul_epu32(aHigh, b1), _mm256_mul_epu32(a, b1High));
+			acc[i][0] = _mm256_add_epi64(acc[i][0], _mm256_add_epi64(_mm256_mul_epu32(a, b0), _mm256_slli_epi64(cross0, 32)));
+			acc[i][1] = _mm256_add_epi64(acc[i][1], _mm256_add_epi64(_mm256_mul_epu32(a, b1), _mm256_slli_epi64(cross1, 32)));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm256_storeu_si256((__m256i*)(tile + i * 8), acc[i][0]);
+		_mm256_storeu_si256((__m256i*)(tile + i * 8 + 4), acc[i][1]);
+	}
+}
+
+template<int KC>
+TARGET_AVX512 inline void micro_kernel_wrapping64_avx512(int kc, const long long* packedA, const long long* packedB, uint64_t* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m512i acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_setzero_si512();
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 16)
+	{
+		__m512i b0 = _mm512_loadu_si512(packedB);
+		__m512i b1 = _mm512_loadu_si512(packedB + 8);
+		__m512i b0High = _mm512_srli_epi64(b0, 32);
+		__m512i b1High = _mm512_srli_epi64(b1, 32);
+		for (int i = 0; i < 6; i++)
+		{
+			__m512i a = _mm512_set1_epi64(packedA[i]);
+			__m512i aHigh = _mm512_set1_epi64((long long)((uint64_t)packedA[i] >> 32));
+			__m512i cross0 = _mm512_add_epi64(_mm512_mul_epu32(aHigh, b0), _mm512_mul_epu32(a, b0High));
+			__m512i cross1 = _mm512_add_epi64(_mm512_mul_epu32(aHigh, b1), _mm512_mul_epu32(a, b1High));
+			acc[i][0] = _mm512_add_epi64(acc[i][0], _mm512_add_epi64(_mm512_mul_epu32(a, b0), _mm512_slli_epi64(cross0, 32)));
+			acc[i][1] = _mm512_add_epi64(acc[i][1], _mm512_add_epi64(_mm512_mul_epu32(a, b1), _mm512_slli_epi64(cross1, 32)));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_si512(tile + i * 16, acc[i][0]);
+		_mm512_storeu_si512(tile + i * 16 + 8, acc[i][1]);
+	}
+}
+
+// tropical kernels: the double kernels with the fma replaced by an add followed by min (or max)
+
+template<bool MAX, int KC>
+TARGET_SSE4 inline void micro_kernel_tropical_sse4(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m128d acc[4][2];
+	for (int i = 0; i < 4; i++)
+		acc[i][0] = acc[i][1] = _mm_set1_pd(TropicalSemiring<MAX>::zero());
+
+	for (int k = 0; k < depth; k++, packedA += 4, packedB += 4)
+	{
+		__m128d b0 = _mm_loadu_pd(packedB);
+		__m128d b1 = _mm_loadu_pd(packedB + 2);
+		for (int i = 0; i < 4; i++)
+		{
+			__m128d a = _mm_set1_pd(packedA[i]);
+			acc[i][0] = MAX ? _mm_max_pd(acc[i][0], _mm_add_pd(a, b0)) : _mm_min_pd(acc[i][0], _mm_add_pd(a, b0));
+			acc[i][1] = MAX ? _mm_max_pd(acc[i][1], _mm_add_pd(a, b1)) : _mm_min_pd(acc[i][1], _mm_add_pd(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_pd(tile + i * 4, acc[i][0]);
+		_mm_storeu_pd(tile + i * 4 + 2, acc[i][1]);
+	}
+}
+
+template<bool MAX, int KC>
+TARGET_AVX2 inline void micro_kernel_tropical_avx2(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m256d acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm256_set1_pd(TropicalSemiring<MAX>::zero());
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 8)
+	{
+		__m256d b0 = _mm256_loadu_pd(packedB);
+		__m256d b1 = _mm256_loadu_pd(packedB + 4);
+		for (int i = 0; i < 6; i++)
+		{
+			__m256d a = _mm256_broadcast_sd(packedA + i);
+			acc[i][0] = MAX ? _mm256_max_pd(acc[i][0], _mm256_add_pd(a, b0)) : _mm256_min_pd(acc[i][0], _mm256_add_pd(a, b0));
+			acc[i][1] = MAX ? _mm256_max_pd(acc[i][1], _mm256_add_pd(a, b1)) : _mm256_min_pd(acc[i][1], _mm256_add_pd(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm256_storeu_pd(tile + i * 8, acc[i][0]);
+		_mm256_storeu_pd(tile + i * 8 + 4, acc[i][1]);
+	}
+}
+
+template<bool MAX, int KC>
+TARGET_AVX512 inline void micro_kernel_tropical_avx512(int kc, const double* packedA, const double* packedB, double* tile)
+{
+	const int depth = KC > 0 ? KC : kc;
+	__m512d acc[6][2];
+	for (int i = 0; i < 6; i++)
+		acc[i][0] = acc[i][1] = _mm512_set1_pd(TropicalSemiring<MAX>::zero());
+
+	for (int k = 0; k < depth; k++, packedA += 6, packedB += 16)
+	{
+		__m512d b0 = _mm512_loadu_pd(packedB);
+		__m512d b1 = _mm512_loadu_pd(packedB + 8);
+		for (int i = 0; i < 6; i++)
+		{
+			__m512d a = _mm512_set1_pd(packedA[i]);
+			acc[i][0] = MAX ? _mm512_max_pd(acc[i][0], _mm512_add_pd(a, b0)) : _mm512_min_pd(acc[i][0], _mm512_add_pd(a, b0));
+			acc[i][1] = MAX ? _mm512_max_pd(acc[i][1], _mm512_add_pd(a, b1)) : _mm512_min_pd(acc[i][1], _mm512_add_pd(a, b1));
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		_mm512_storeu_pd(tile + i * 16, acc[i][0]);
+		_mm512_storeu_pd(tile + i * 16 + 8, acc[i][1]);
+	}
+}
+#endif
+
+inline const MicroKernel<int, uint64_t>& ModularRing::kernel()
+{
+	static const MicroKernel<int, uint64_t> kernel = []() -> MicroKernel<int, uint64_t>
+	{
+		switch (active_isa())
+		{
+#ifdef KERNELS_X86
+		case ISA_AVX512:
+			return { 6, 16, micro_kernel_modular_avx512<0>, micro_kernel_modular_avx512<BLOCK_KC> };
+		case ISA_AVX2:
+			return { 6, 8, micro_kernel_modular_avx2<0>, micro_kernel_modular_avx2<BLOCK_KC> };
+		case ISA_SSE4:
+			return { 4, 4, micro_kernel_modular_sse4<0>, micro_kernel_modular_sse4<BLOCK_KC> };
+#endif
+		default:
+			return { 4, 8, micro_kernel_ring_scalar<ModularRing, 4, 8, 0>, micro_kernel_ring_scalar<ModularRing, 4, 8, BLOCK_KC> };
+		}
+	}();
+	return kernel;
+}
+
+inline const MicroKernel<long long, uint64_t>& Wrapping64Ring::kernel()
+{
+	static const MicroKernel<long long, uint64_t> kernel = []() -> MicroKernel<long long, uint64_t>
+	{
+		switch (active_isa())
+		{
+#ifdef KERNELS_X86
+		case ISA_AVX512:
+			return { 6, 16, micro_kernel_wrapping64_avx512<0>, micro_kernel_wrapping64_avx512<BLOCK_KC> };
+		case ISA_AVX2:
+			return { 4, 8, micro_kernel_wrapping64_avx2<0>, micro_kernel_wrapping64_avx2<BLOCK_KC> };
+#endif
+		default:
+			return { 4, 8, micro_kernel_ring_scalar<Wrapping64Ring, 4, 8, 0>, micro_kernel_ring_scalar<Wrapping64Ring, 4, 8, BLOCK_KC> };
+		}
+	}();
+	return kernel;
+}
+
+template<bool MAX>
+const MicroKernel<double>& TropicalSemiring<MAX>::kernel()
+{
+	static const MicroKernel<double> kernel = []() -> MicroKernel<double>
+	{
+		switch (active_isa())
+		{
+#ifdef KERNELS_X86
+		case ISA_AVX512:
+			return { 6, 16, micro_kernel_tropical_avx512<MAX, 0>, micro_kernel_tropical_avx512<MAX, BLOCK_KC> };
+		case ISA_AVX2:
+			return { 6, 8, micro_kernel_tropical_avx2<MAX, 0>, micro_kernel_tropical_avx2<MAX, BLOCK_KC> };
+		case ISA_SSE4:
+			return { 4, 4, micro_kernel_tropical_sse4<MAX, 0>, micro_kernel_tropical_sse4<MAX, BLOCK_KC> };
+#endif
+		default:
+			return { 4, 8, micro_kernel_ring_scalar<TropicalSemiring<MAX>, 4, 8, 0>, micro_kernel_ring_scalar<TropicalSemiring<MAX>, 4, 8, BLOCK_KC> };
+		}
+	}();
+	return kernel;
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "matrix.h"
+#include "thread_pool.h"
+
+// Sparse operands are packed into one byte buffer as block CSR: the matrix is cut into SPARSE_BLOCK x SPARSE_BLOCK
+// blocks (or 1 x 1, which is plain CSR) and only the blocks holding an element other than the ring's zero are kept.
+// An operand goes sparse when the elements it would keep are at most the threshold share of all of them;
+// CSR is picked unless the blocks keep at most twice as many elements, as clustered nonzeros do
+#define SPARSE_THRESHOLD 0.05
+#define SPARSE_BLOCK 8
+#define SPARSE_ALIGNMENT 64
+
+// the packed form: this header, rowStart (blockRows + 1 block indices), columns (the block column of each block),
+// then, from the next SPARSE_ALIGNMENT boundary, the blocks row by row, each blockSize x blockSize elements
+struct SparseHeader
+{
+	int32_t rows;
+	int32_t cols;
+	int32_t blockSize;
+	int32_t blockCount;
+};
+
+template<typename T>
+struct SparseView
+{
+	int rows;
+	int cols;
+	int blockSize;
+	int blockRows;
+	const int32_t* rowStart;
+	const int32_t* columns;
+	const T* values;
+};
+
+// prototypes
+size_t sparse_values_offset(int rows, int blockSize, int blockCount);
+
+// template prototypes
+template<typename T>
+size_t sparse_packed_size(int rows, int blockSize, int blockCount);
+template<typename T>
+SparseView<T> sparse_view(const char* packed);
+template<typename T>
+int count_sparse_blocks(const Matrix<T>& matrix, T zero, int blockSize);
+template<typename T>
+void pack_sparse(const Matrix<T>& matrix, T zero, int blockSize, int blockCount, char* packed);
+template<typename Ring, typename T>
+bool pack_if_sparse(const Matrix<T>& matrix, double threshold, std::vector<char>& packed);
+template<typename Ring, typename T>
+void sparse_dense_multiply(const SparseView<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n3, ThreadPool& pool);
+template<typename Ring, typename T>
+void dense_sparse_multiply(const Matrix<T>& A, const SparseView<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, ThreadPool& pool);
+template<typename Ring, typename T>
+void sparse_sparse_multiply(const SparseView<T>& A, const SparseView<T>& B, Matrix<typename Ring::Result>& C, ThreadPool& pool);
+
+// functions
+inline size_t sparse_values_offset(int rows, int blockSize, int blockCount)
+{
+	int blockRows = (rows + blockSize - 1) / blockSize;
+	size_t indices = sizeof(SparseHeader) + ((size_t)blockRows + 1 + blockCount) * sizeof(int32_t);
+	return (indices + SPARSE_ALIGNMENT - 1) / SPARSE_ALIGNMENT * SPARSE_ALIGNMENT;
+}
+
+// templates
+template<typename T>
+size_t sparse_packed_size(int rows, int blockSize, int blockCount)
+{
+	return sparse_values_offset(rows, blockSize, blockCount) + (size_t)blockCount * blockSize * blockSize * sizeof(T);
+}
+
+template<typename T>
+SparseView<T> sparse_view(const char* packed)
+{
+	SparseHeader header;
+	memcpy(&header, packed, sizeof(header));
+	SparseView<T> view;
+	view.rows = header.rows;
+	view.cols = header.cols;
+	view.blockSize = header.blockSize;
+	view.blockRows = (header.rows + header.blockSize - 1) / header.blockSize;
+	view.rowStart = (const int32_t*)(packed + sizeof(header));
+	view.columns = view.rowStart + view.blockRows + 1;
+	view.values = (const T*)(packed + sparse_values_offset(header.rows, header.blockSize, header.blockCount));
+	return view;
+}
+
+// blocks of blockSize x blockSize (the last ones cut at the edges) holding an element other than zero
+template<typename T>
+int count_sparse_blocks(const Matrix<T>& matrix, T zero, int blockSize)
+{
+	int count = 0;
+	for (int startH = 0; startH < matrix.height(); startH += blockSize)
+		for (int startW = 0; startW < matrix.width(); startW += blockSize)
+		{
+			bool found = false;
+			for (int i = startH; i < std::min(startH + blockSize, matrix.height()) && !found; i++)
+				for (int j = startW; j < std::min(startW + blockSize, matrix.width()) && !found; j++)
+					found = !(matrix[i][j] == zero);
+			count += found;
+		}
+	return count;
+}
+
+// packed must hold sparse_packed_size<T>(rows, blockSize, blockCount) bytes; the blocks at the edges are filled up with zero
+template<typename T>
+void pack_sparse(const Matrix<T>& matrix, T zero, int blockSize, int blockCount, char* packed)
+{
+	int rows = matrix.height(), cols = matrix.width();
+	SparseHeader header = { rows, cols, blockSize, blockCount };
+	memcpy(packed, &header, sizeof(header));
+	int32_t* rowStart = (int32_t*)(packed + sizeof(header));
+	int blockRows = (rows + blockSize - 1) / blockSize;
+	int32_t* columns = rowStart + blockRows + 1;
+	T* values = (T*)(packed + sparse_values_offset(rows, blockSize, blockCount));
+
+	int block = 0;
+	for (int blockRow = 0; blockRow < blockRows; blockRow++)
+	{
+		rowStart[blockRow] = block;
+		int startH = blockRow * blockSize, stopH = std::min(startH + blockSize, rows);
+		for (int startW = 0; startW < cols; startW += blockSize)
+		{
+			int stopW = std::min(startW + blockSize, cols);
+			bool found = false;
+			for (int i = startH; i < stopH && !found; i++)
+				for (int j = startW; j < stopW && !found; j++)
+					found = !(matrix[i][j] == zero);
+			if (!found)
+				continue;
+
+			T* destination = values + (size_t)block * blockSize * blockSize;
+			for (int i = 0; i < blockSize; i++)
+				for (int j = 0; j < blockSize; j++)
+					destination[i * blockSize + j] = startH + i < stopH && startW + j < stopW ? matrix[startH + i][startW + j] : zero;
+			columns[block++] = startW / blockSize;
+		}
+	}
+	rowStart[blockRows] = block;
+}
+
+// packs the matrix when it is sparse enough for the threshold, picking CSR or SPARSE_BLOCK blocks;
+// a negative threshold keeps every operand dense
+template<typename Ring, typename T>
+bool pack_if_sparse(const Matrix<T>& matrix, double threshold, std::vector<char>& packed)
+{
+	size_t size = matrix.size();
+	if (threshold < 0 || size == 0)
+		return false;
+
+	T zero = (T)Ring::zero();
+	int nonzeros = count_sparse_blocks(matrix, zero, 1);
+	int blocks = count_sparse_blocks(matrix, zero, SPARSE_BLOCK);
+	size_t blockElements = (size_t)blocks * SPARSE_BLOCK * SPARSE_BLOCK;
+	int blockSize = blockElements <= 2 * (size_t)nonzeros ? SPARSE_BLOCK : 1;
+	int blockCount = blockSize == 1 ? nonzeros : blocks;
+	if ((double)(blockSize == 1 ? nonzeros : blockElements) > threshold * size)
+		return false;
+
+	packed.resize(sparse_packed_size<T>(matrix.height(), blockSize, blockCount));
+	pack_sparse(matrix, zero, blockSize, blockCount, packed.data());
+	return true;
+}
+
+// C = A * B for a sparse A. Each task computes a block row of C in accumulators; an element of A equal to the
+// ring's zero adds nothing and is skipped. The accumulators are folded every Ring::delay() inner steps
+template<typename Ring, typename T>
+void sparse_dense_multiply(const SparseView<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C, int n3, ThreadPool& pool)
+{
+	typedef typename Ring::Accumulator Accumulator;
+	const T zero = (T)Ring::zero();
+	const int bs = A.blockSize;
+	pool.parallel_for(A.blockRows, [&](int blockRow)
+	{
+		int startH = blockRow * bs, height = std::min(bs, A.rows - startH);
+		std::vector<Accumulator> acc((size_t)height * n3, (Accumulator)Ring::zero());
+		int products = 0;
+		for (int p = A.rowStart[blockRow]; p < A.rowStart[blockRow + 1]; p++)
+		{
+			int startK = A.columns[p] * bs, depth = std::min(bs, A.cols - startK);
+			const T* block = A.values + (size_t)p * bs * bs;
+			for (int kk = 0; kk < depth; kk++)
+			{
+				const T* b = B[startK + kk];
+				for (int ii = 0; ii < height; ii++)
+				{
+					T a = block[ii * bs + kk];
+					if (a == zero)
+						continue;
+					Accumulator* c = acc.data() + (size_t)ii * n3;
+					for (int j = 0; j < n3; j++)
+						c[j] = Ring::multiply_add(c[j], a, b[j]);
+				}
+				if (++products == Ring::delay())
+				{
+					for (size_t e = 0; e < acc.size(); e++)
+						acc[e] = Ring::fold(acc[e]);
+					products = 0;
+				}
+			}
+		}
+		for (int ii = 0; ii < height; ii++)
+			for (int j = 0; j < n3; j++)
+				C[startH + ii][j] = Ring::accumulate(Ring::zero(), acc[(size_t)ii * n3 + j]);
+	});
+}
+
+// C = A * B for a sparse B: every row of C goes through the nonzero blocks of B in accumulators
+template<typename Ring, typename T>
+void dense_sparse_multiply(const Matrix<T>& A, const SparseView<T>& B, Matrix<typename Ring::Result>& C, int n1, int n2, ThreadPool& pool)
+{
+	typedef typename Ring::Accumulator Accumulator;
+	const T zero = (T)Ring::zero();
+	const int bs = B.blockSize, n3 = B.cols;
+	pool.parallel_for(n1, [&](int i)
+	{
+		std::vector<Accumulator> acc(n3, (Accumulator)Ring::zero());
+		int products = 0;
+		for (int blockRow = 0; blockRow < B.blockRows; blockRow++)
+		{
+			int startK = blockRow * bs, depth = std::min(bs, n2 - startK);
+			for (int kk = 0; kk < depth; kk++)
+			{
+				T a = A[i][startK + kk];
+				if (a == zero || B.rowStart[blockRow] == B.rowStart[blockRow + 1])
+					continue;
+				for (int p = B.rowStart[blockRow]; p < B.rowStart[blockRow + 1]; p++)
+				{
+					int startW = B.columns[p] * bs, width = std::min(bs, n3 - startW);
+					const T* b = B.values + (size_t)p * bs * bs + (size_t)kk * bs;
+					for (int jj = 0; jj < width; jj++)
+						acc[startW + jj] = Ring::multiply_add(acc[startW + jj], a, b[jj]);
+				}
+				if (++products == Ring::delay())
+				{
+					for (int j = 0; j < n3; j++)
+						acc[j] = Ring::fold(acc[j]);
+					products = 0;
+				}
+			}
+		}
+		for (int j = 0; j < n3; j++)
+			C[i][j] = Ring::accumulate(Ring::zero(), acc[j]);
+	});
+}
+
+// C = A * B for sparse A and B (Gustavson): a nonzero of A in column k scales the nonzero blocks of B's row k
+template<typename Ring, typename T>
+void sparse_sparse_multiply(const SparseView<T>& A, const SparseView<T>& B, Matrix<typename Ring::Result>& C, ThreadPool& pool)
+{
+	typedef typename Ring::Accumulator Accumulator;
+	const T zero = (T)Ring::zero();
+	const int bsA = A.blockSize, bsB = B.blockSize, n3 = B.cols;
+	pool.parallel_for(A.blockRows, [&](int blockRow)
+	{
+		int startH = blockRow * bsA, height = std::min(bsA, A.rows - startH);
+		std::vector<Accumulator> acc((size_t)height * n3, (Accumulator)Ring::zero());
+		int products = 0;
+		for (int p = A.rowStart[blockRow]; p < A.rowStart[blockRow + 1]; p++)
+		{
+			int startK = A.columns[p] * bsA, depth = std::min(bsA, A.cols - startK);
+			const T* block = A.values + (size_t)p * bsA * bsA;
+			for (int kk = 0; kk < depth; kk++)
+			{
+				int k = startK + kk, rowB = k / bsB, offsetB = k % bsB;
+				if (B.rowStart[rowB] == B.rowStart[rowB + 1])
+					continue;
+				for (int ii = 0; ii < height; ii++)
+				{
+					T a = block[ii * bsA + kk];
+					if (a == zero)
+						continue;
+					Accumulator* c = acc.data() + (size_t)ii * n3;
+					for (int q = B.rowStart[rowB]; q < B.rowStart[rowB + 1]; q++)
+					{
+						int startW = B.columns[q] * bsB, width = std::min(bsB, n3 - startW);
+						const T* b = B.values + (size_t)q * bsB * bsB + (size_t)offsetB * bsB;
+						for (int jj = 0; jj < width; jj++)
+							c[startW + jj] = Ring::multiply_add(c[startW + jj], a, b[jj]);
+					}
+				}
+				if (++products == Ring::delay())
+				{
+					for (size_t e = 0; e < acc.size(); e++)
+						acc[e] = Ring::fold(acc[e]);
+					products = 0;
+				}
+			}
+		}
+		for (int ii = 0; ii < height; ii++)
+			for (int j = 0; j < n3; j++)
+				C[startH + ii][j] = Ring::accumulate(Ring::zero(), acc[(size_t)ii * n3 + j]);
+	});
+}
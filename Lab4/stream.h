@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Stream mode multiplies matrices that don't fit in memory. C is cut into tiles the ranks take in turn;
+// a C tile sums the products of the A tiles of its rows and the B tiles of its columns, each pair read
+// from the files while the pair before it is multiplied, and goes back to the file while the next tile
+// is computed. So a rank holds two tiles each of A, B and C, as large as the memory budget allows.
+// A text C is put together in a binary scratch file first and converted once all tiles are in
+#define STREAM_MEMORY_MB 1024
+#define STREAM_TILE_GRANULE 64
+#define STREAM_SCRATCH_SUFFIX ".stream.bin"
+
+// A tiles are tileH x tileK, B tiles tileK x tileW and C tiles tileH x tileW (the last tile of each row
+// and column may be smaller); fits is false when even the smallest tiles need more than the budget
+struct StreamPlan
+{
+	int n1;
+	int n2;
+	int n3;
+	int tileH;
+	int tileK;
+	int tileW;
+	int rowTiles;
+	int depthTiles;
+	int colTiles;
+	bool fits;
+};
+
+// what a rank works on in one step: the k-th A tile (rows startH.., columns startK..) and B tile
+// (rows startK.., columns startW..) of the C tile it sums in its slot-th turn
+struct StreamStep
+{
+	int slot;
+	int k;
+	int startH;
+	int height;
+	int startK;
+	int depth;
+	int startW;
+	int width;
+};
+
+// prototypes
+size_t stream_working_set(int tileH, int tileK, int tileW, size_t elementSize, size_t resultSize);
+StreamPlan plan_stream(int n1, int n2, int n3, size_t budget, size_t elementSize, size_t resultSize);
+int stream_step_count(const StreamPlan& plan, int rank, int ranks);
+StreamStep stream_step(const StreamPlan& plan, int rank, int ranks, int step);
+
+// functions
+// two of each tile: the operands being multiplied and the ones being read, the C tile being summed and
+// the one being written
+inline size_t stream_working_set(int tileH, int tileK, int tileW, size_t elementSize, size_t resultSize)
+{
+	return 2 * (((size_t)tileH * tileK + (size_t)tileK * tileW) * elementSize + (size_t)tileH * tileW * resultSize);
+}
+
+// square tiles of the largest side (a multiple of STREAM_TILE_GRANULE) whose working set fits the budget,
+// cut down to the dimensions where those are smaller
+inline StreamPlan plan_stream(int n1, int n2, int n3, size_t budget, size_t elementSize, size_t resultSize)
+{
+	int largest = std::max(n1, std::max(n2, n3));
+	int low = 1, high = (largest + STREAM_TILE_GRANULE - 1) / STREAM_TILE_GRANULE;
+	while (low < high)
+	{
+		int granules = low + (high - low + 1) / 2;
+		int side = granules * STREAM_TILE_GRANULE;
+		if (stream_working_set(std::min(side, n1), std::min(side, n2), std::min(side, n3), elementSize, resultSize) <= budget)
+			low = granules;
+		else
+			high = granules - 1;
+	}
+
+	int side = low * STREAM_TILE_GRANULE;
+	StreamPlan plan;
+	plan.n1 = n1;
+	plan.n2 = n2;
+	plan.n3 = n3;
+	plan.tileH = std::min(side, n1);
+	plan.tileK = std::min(side, n2);
+	plan.tileW = std::min(side, n3);
+	plan.rowTiles = (n1 + plan.tileH - 1) / plan.tileH;
+	plan.depthTiles = (n2 + plan.tileK - 1) / plan.tileK;
+	plan.colTiles = (n3 + plan.tileW - 1) / plan.tileW;
+	plan.fits = stream_working_set(plan.tileH, plan.tileK, plan.tileW, elementSize, resultSize) <= budget;
+	return plan;
+}
+
+// the C tiles go to the ranks in turn: rank r sums tiles r, r + ranks, ... (numbered row by row)
+inline int stream_step_count(const StreamPlan& plan, int rank, int ranks)
+{
+	int tiles = plan.rowTiles * plan.colTiles;
+	return rank < tiles ? (tiles - rank + ranks - 1) / ranks * plan.depthTiles : 0;
+}
+
+inline StreamStep stream_step(const StreamPlan& plan, int rank, int ranks, int step)
+{
+	StreamStep tiles;
+	tiles.slot = step / plan.depthTiles;
+	tiles.k = step % plan.depthTiles;
+	int tile = rank + tiles.slot * ranks;
+	tiles.startH = tile / plan.colTiles * plan.tileH;
+	tiles.height = std::min(plan.tileH, plan.n1 - tiles.startH);
+	tiles.startK = tiles.k * plan.tileK;
+	tiles.depth = std::min(plan.tileK, plan.n2 - tiles.startK);
+	tiles.startW = tile % plan.colTiles * plan.tileW;
+	tiles.width = std::min(plan.tileW, plan.n3 - tiles.startW);
+	return tiles;
+}
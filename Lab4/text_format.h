@@ -0,0 +1,233 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "matrix_format.h"
+
+// Text matrix file: one matrix row per line, elements separated by spaces or tabs, blank lines ignored.
+// Elements are parsed with from_chars and printed with to_chars, so neither side depends on the locale.
+// Files are read through a mapping and written through one large buffer
+#define TEXT_WRITE_BUFFER_SIZE (1 << 20)
+#define TEXT_MAX_ELEMENT_LENGTH 32
+
+// where the non-blank lines of a mapped text file start and end: row i is [begin[i], end[i])
+struct TextRowIndex
+{
+	std::vector<const char*> begin;
+	std::vector<const char*> end;
+};
+
+// a text matrix file mapped once with all its rows indexed, for reading many slabs of it
+struct TextMatrixFile
+{
+	MappedFile file;
+	TextRowIndex index;
+};
+
+// prototypes
+bool is_text_space(char symbol);
+const char* skip_text_spaces(const char* first, const char* last);
+int build_text_row_index(const char* data, size_t size, int maxRows, TextRowIndex& index);
+int count_text_elements(const char* first, const char* last);
+bool read_text_matrix_dimensions(const char* fileName, int& height, int& width);
+bool open_text_matrix_file(const char* fileName, TextMatrixFile& text);
+
+// template prototypes
+template<typename T>
+const char* parse_text_elements(const char* first, const char* last, T* destination, int skip, int count);
+template<typename T>
+bool read_text_rows(const TextRowIndex& index, T* destination, int ld, int startH, int height, int startW, int width);
+template<typename T>
+bool read_text_matrix_slab(const char* fileName, T* destination, int ld, int startH, int height, int startW, int width);
+template<typename T>
+bool write_text_matrix_file(const char* fileName, const T* source, int height, int width, int ld);
+template<typename T>
+void format_text_rows(const T* source, int height, int width, int ld, bool lastRows, std::vector<char>& text);
+
+// functions
+inline bool is_text_space(char symbol)
+{
+	return symbol == ' ' || symbol == '\t' || symbol == '\r' || symbol == '\n';
+}
+
+inline const char* skip_text_spaces(const char* first, const char* last)
+{
+	while (first != last && is_text_space(*first))
+		first++;
+	return first;
+}
+
+// only line ends are looked for (memchr), the elements themselves are not tokenized;
+// scanning stops once maxRows rows are indexed (maxRows < 0 indexes the whole file)
+inline int build_text_row_index(const char* data, size_t size, int maxRows, TextRowIndex& index)
+{
+	index.begin.clear();
+	index.end.clear();
+
+	const char* line = data;
+	const char* last = data + size;
+	while (line != last && (maxRows < 0 || (int)index.begin.size() < maxRows))
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', last - line);
+		if (lineEnd == nullptr)
+			lineEnd = last;
+		if (skip_text_spaces(line, lineEnd) != lineEnd)
+		{
+			index.begin.push_back(line);
+			index.end.push_back(lineEnd);
+		}
+		line = lineEnd == last ? last : lineEnd + 1;
+	}
+	return (int)index.begin.size();
+}
+
+inline int count_text_elements(const char* first, const char* last)
+{
+	int count = 0;
+	for (first = skip_text_spaces(first, last); first != last; first = skip_text_spaces(first, last))
+	{
+		while (first != last && !is_text_space(*first))
+			first++;
+		count++;
+	}
+	return count;
+}
+
+inline bool read_text_matrix_dimensions(const char* fileName, int& height, int& width)
+{
+	height = 0;
+	width = 0;
+
+	MappedFile file;
+	if (!file.open(fileName))
+		return false;
+
+	TextRowIndex index;
+	height = build_text_row_index(file.data(), file.size(), -1, index);
+	if (height > 0)
+		width = count_text_elements(index.begin[0], index.end[0]);
+	return true;
+}
+
+inline bool open_text_matrix_file(const char* fileName, TextMatrixFile& text)
+{
+	if (!text.file.open(fileName))
+		return false;
+	build_text_row_index(text.file.data(), text.file.size(), -1, text.index);
+	return true;
+}
+
+// templates
+// skips `skip` elements, then parses `count` elements into destination; nullptr when the line runs short
+template<typename T>
+const char* parse_text_elements(const char* first, const char* last, T* destination, int skip, int count)
+{
+	for (int j = 0; j < skip; j++)
+	{
+		first = skip_text_spaces(first, last);
+		if (first == last)
+			return nullptr;
+		while (first != last && !is_text_space(*first))
+			first++;
+	}
+
+	for (int j = 0; j < count; j++)
+	{
+		first = skip_text_spaces(first, last);
+		if (first != last && *first == '+')
+			first++;
+		std::from_chars_result result = std::from_chars(first, last, destination[j]);
+		if (result.ec != std::errc())
+			return nullptr;
+		first = result.ptr;
+	}
+	return first;
+}
+
+// copies rows [startH, startH + height) and columns [startW, startW + width) of an indexed file into
+// destination (row stride ld); false when the index has too few rows or a row runs short
+template<typename T>
+bool read_text_rows(const TextRowIndex& index, T* destination, int ld, int startH, int height, int startW, int width)
+{
+	if (height <= 0 || width <= 0)
+		return true;
+	if ((int)index.begin.size() < startH + height)
+		return false;
+
+	for (int i = 0; i < height; i++)
+		if (parse_text_elements(index.begin[startH + i], index.end[startH + i], destination + (size_t)i * ld, startW, width) == nullptr)
+			return false;
+	return true;
+}
+
+// the same slab of a file mapped for this read alone; the row index stops at the last row of the slab
+template<typename T>
+bool read_text_matrix_slab(const char* fileName, T* destination, int ld, int startH, int height, int startW, int width)
+{
+	if (height <= 0 || width <= 0)
+		return true;
+
+	MappedFile file;
+	if (!file.open(fileName))
+		return false;
+
+	TextRowIndex index;
+	build_text_row_index(file.data(), file.size(), startH + height, index);
+	return read_text_rows(index, destination, ld, startH, height, startW, width);
+}
+
+template<typename T>
+bool write_text_matrix_file(const char* fileName, const T* source, int height, int width, int ld)
+{
+	std::ofstream fout(fileName);
+	if (!fout)
+		return false;
+
+	std::vector<char> buffer(TEXT_WRITE_BUFFER_SIZE);
+	char* position = buffer.data();
+	char* bufferEnd = buffer.data() + buffer.size();
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			if (bufferEnd - position < TEXT_MAX_ELEMENT_LENGTH + 2)
+			{
+				fout.write(buffer.data(), position - buffer.data());
+				position = buffer.data();
+			}
+			position = std::to_chars(position, bufferEnd, source[(size_t)i * ld + j]).ptr;
+			if (j != width - 1)
+				*position++ = ' ';
+		}
+		if (i != height - 1)
+			*position++ = '\n';
+	}
+	fout.write(buffer.data(), position - buffer.data());
+	return (bool)fout;
+}
+
+// appends the rows as they appear in a text file; every row ends with a line break
+// unless these are the last rows of the matrix, so blocks formatted apart can be written one after another
+template<typename T>
+void format_text_rows(const T* source, int height, int width, int ld, bool lastRows, std::vector<char>& text)
+{
+	size_t start = text.size();
+	text.resize(start + (size_t)height * width * (TEXT_MAX_ELEMENT_LENGTH + 1) + height);
+	char* position = text.data() + start;
+	char* textEnd = text.data() + text.size();
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			position = std::to_chars(position, textEnd, source[(size_t)i * ld + j]).ptr;
+			if (j != width - 1)
+				*position++ = ' ';
+		}
+		if (i != height - 1 || !lastRows)
+			*position++ = '\n';
+	}
+	text.resize(position - text.data());
+}
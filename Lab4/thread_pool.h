@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// keeps the work ranges of different threads on different cache lines
+#define CACHE_LINE_SIZE 64
+
+// fixed set of worker threads that run the iterations of parallel_for together with the calling thread.
+// Every thread starts with a contiguous range of iterations (neighbouring tiles of C share rows of A)
+// and works through it from the front; a thread that runs dry steals the back half of another thread's range.
+// Only the calling thread talks to MPI, the workers just compute (MPI_THREAD_FUNNELED is enough)
+class ThreadPool
+{
+public:
+	// threadCount counts the calling thread too; 0 means one thread per hardware thread
+	explicit ThreadPool(int threadCount);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const { return (int)workers.size() + 1; }
+	// runs task(0) ... task(count - 1) and returns once all of them are done
+	void parallel_for(int count, const std::function<void(int)>& task);
+
+private:
+	// [begin, end) packed into one word, so the owner and the thieves both change it with a single CAS
+	struct alignas(CACHE_LINE_SIZE) WorkRange
+	{
+		std::atomic<uint64_t> bounds;
+	};
+
+	static uint64_t pack_range(uint32_t begin, uint32_t end) { return (uint64_t)begin << 32 | end; }
+	void worker_loop(int self);
+	void run_iterations(int self);
+	bool take_own(int self, int& index);
+	bool steal(int self, int& index);
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<WorkRange[]> ranges;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(int)>* currentTask;
+	int busyWorkers;
+	unsigned long long generation;
+	bool stopping;
+};
+
+// functions
+inline ThreadPool::ThreadPool(int threadCount) : currentTask(nullptr), busyWorkers(0), generation(0), stopping(false)
+{
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+	ranges.reset(new WorkRange[threadCount]);
+	for (int i = 0; i < threadCount; i++)
+		ranges[i].bounds = 0;
+	for (int i = 1; i < threadCount; i++)
+		workers.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+inline void ThreadPool::parallel_for(int count, const std::function<void(int)>& task)
+{
+	if (workers.empty() || count <= 1)
+	{
+		for (int i = 0; i < count; i++)
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentTask = &task;
+		for (int i = 0; i < size(); i++)
+			ranges[i].bounds = pack_range((uint32_t)((long long)count * i / size()), (uint32_t)((long long)count * (i + 1) / size()));
+		busyWorkers = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	run_iterations(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busyWorkers == 0; });
+	currentTask = nullptr;
+}
+
+inline void ThreadPool::worker_loop(int self)
+{
+	unsigned long long seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = generation;
+		}
+
+		run_iterations(self);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0)
+			done.notify_one();
+	}
+}
+
+// no iterations are created while running, so a thread that finds every range empty is done
+inline void ThreadPool::run_iterations(int self)
+{
+	int index;
+	while (take_own(self, index) || steal(self, index))
+		(*currentTask)(index);
+}
+
+inline bool ThreadPool::take_own(int self, int& index)
+{
+	uint64_t bounds = ranges[self].bounds.load();
+	for (;;)
+	{
+		uint32_t begin = (uint32_t)(bounds >> 32), end = (uint32_t)bounds;
+		if (begin >= end)
+			return false;
+		if (ranges[self].bounds.compare_exchange_weak(bounds, pack_range(begin + 1, end)))
+		{
+			index = (int)begin;
+			return true;
+		}
+	}
+}
+
+// the thief runs the first stolen iteration at once and keeps the rest as its own range
+inline bool ThreadPool::steal(int self, int& index)
+{
+	for (int offset = 1; offset < size(); offset++)
+	{
+		WorkRange& victim = ranges[(self + offset) % size()];
+		uint64_t bounds = victim.bounds.load();
+		for (;;)
+		{
+			uint32_t begin = (uint32_t)(bounds >> 32), end = (uint32_t)bounds;
+			if (begin >= end)
+				break;
+			uint32_t middle = begin + (end - begin) / 2;
+			if (victim.bounds.compare_exchange_weak(bounds, pack_range(begin, middle)))
+			{
+				ranges[self].bounds = pack_range(middle + 1, end);
+				index = (int)middle;
+				return true;
+			}
+		}
+	}
+	return false;
+}
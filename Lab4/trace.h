@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Phase timeline of a run. Every rank notes the phases its calling thread goes through (the file reads,
+// every exchange, every multiply, the writes) and rank 0 merges them into one Chrome trace file
+// (chrome://tracing or Perfetto), a process per rank. Tracing is off unless the "trace" setting names
+// the file; a phase then costs two clock reads and a push_back
+#define TRACE_RESERVE 4096
+
+struct TraceEvent
+{
+	// a string literal, so noting a phase copies no text
+	const char* name;
+	// the ring or Cannon step, or the SUMMA panel; -1 for the phases outside the loops
+	int step;
+	// seconds on the trace clock
+	double start;
+	double end;
+};
+
+// the phases of this rank. The clock is MPI_Wtime once MPI runs (a steady clock in seconds before that
+// and in sync mode); origin is the clock time shown as 0 in the trace, the same moment on every rank
+struct TraceLog
+{
+	bool enabled = false;
+	double (*clock)() = nullptr;
+	double origin = 0;
+	std::vector<TraceEvent> events;
+};
+
+// notes the phase from its construction to the end of the scope
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name, int step = -1);
+	~TraceScope();
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	int step;
+	double start;
+};
+
+// prototypes
+double steady_seconds();
+TraceLog& trace_log();
+std::string format_trace_events(int rank);
+bool write_trace_file(const char* fileName, const std::string& events);
+
+// functions
+inline double steady_seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline TraceLog& trace_log()
+{
+	static TraceLog log;
+	return log;
+}
+
+inline TraceScope::TraceScope(const char* name, int step) : name(name), step(step), start(0)
+{
+	TraceLog& log = trace_log();
+	if (log.enabled)
+		start = log.clock();
+}
+
+inline TraceScope::~TraceScope()
+{
+	TraceLog& log = trace_log();
+	if (log.enabled)
+		log.events.push_back({ name, step, start, log.clock() });
+}
+
+// the events of this rank as complete ("X") trace events in microseconds, each followed by ",\n",
+// after a metadata event naming the process after the rank
+inline std::string format_trace_events(int rank)
+{
+	const TraceLog& log = trace_log();
+	std::string text;
+	char line[256];
+	snprintf(line, sizeof(line), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}},\n", rank, rank);
+	text += line;
+	for (size_t i = 0; i < log.events.size(); i++)
+	{
+		const TraceEvent& event = log.events[i];
+		int length = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f",
+			event.name, rank, (event.start - log.origin) * 1e6, (event.end - event.start) * 1e6);
+		if (event.step >= 0)
+			length += snprintf(line + length, sizeof(line) - length, ",\"args\":{\"step\":%d}", event.step);
+		text.append(line, length);
+		text += "},\n";
+	}
+	return text;
+}
+
+// events is what format_trace_events gave for every rank, one after the other
+inline bool write_trace_file(const char* fileName, const std::string& events)
+{
+	std::ofstream fout(fileName);
+	if (!fout)
+		return false;
+
+	size_t length = events.size() >= 2 ? events.size() - 2 : 0;
+	fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	fout.write(events.data(), length);
+	fout << "\n]}\n";
+	return (bool)fout;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include "matrix.h"
+#include "semiring.h"
+#include "sparse.h"
+#include "thread_pool.h"
+
+// Freivalds' check of a product: for a random vector r, A (B r) has to equal C r. Either side costs two
+// matrix-vector products, O(n^2) against the O(n^3) multiply, and a wrong C passes a vector with probability
+// at most 1/2 (1/p for modp), so k vectors leave 2^-k. The k vectors are the columns of an n3 x k matrix R
+// and go through each matrix together. Integer rings compare exactly (in the bits of their C elements),
+// real rings within a tolerance relative to the magnitude of the terms, |A| (|B| |r|) + |C| |r|.
+// The tropical rings have no subtraction: there a wrong element of C only shows when it changes C r.
+// Strassen-Winograd rounds worse than the classical product: its error is only bounded normwise, by the largest
+// magnitudes, and grows with the levels of the recursion. The worst-case bound grows 18 times a level (Higham,
+// Accuracy and Stability of Numerical Algorithms); the errors of real products stay far below it, and a normwise
+// tolerance doubled every level still leaves them a wide margin while catching much smaller wrong elements
+#define VERIFY_ERROR_FACTOR 16
+#define VERIFY_STRASSEN_GROWTH 2
+
+// how the partial products of the ranks combine: the add of the verifier (or of its magnitudes)
+enum VerifyReduction
+{
+	VERIFY_SUM,
+	VERIFY_MIN,
+	VERIFY_MAX
+};
+
+// A verifier does the check in its own Value type: from() turns an element of A, B or C into a Value,
+// multiply(a, x) multiplies it by an element of r, add() sums the products and random() makes an element
+// of r from 64 random bits. reduce() brings a sum of the ranks' partial products back into range and
+// equal() compares the two sides, those of the inexact verifiers within bound. The inexact ones have
+// a Magnitude algebra of the same form over double that bounds the rounding error of the sums
+
+// integers of the plus-times rings and wrap64: everything wraps modulo 2^64 and the sides are compared
+// in the bits of R, which is what C keeps of the exact product
+template<typename R>
+struct IntegerVerifier
+{
+	typedef uint64_t Value;
+	static const bool exact = true;
+	static const VerifyReduction reduction = VERIFY_SUM;
+
+	static uint64_t zero() { return 0; }
+	static uint64_t add(uint64_t a, uint64_t b) { return a + b; }
+	static uint64_t multiply(uint64_t a, uint64_t x) { return a * x; }
+	template<typename X>
+	static uint64_t from(X value) { return (uint64_t)(long long)value; }
+	static uint64_t random(uint64_t word) { return word; }
+	static uint64_t reduce(uint64_t value) { return value; }
+	static bool equal(uint64_t a, uint64_t b, double) { return ((a ^ b) & (~0ULL >> (64 - 8 * sizeof(R)))) == 0; }
+};
+
+// residues modulo p: the products are reduced like the ring reduces them, the sums stay below p
+struct ModularVerifier
+{
+	typedef uint64_t Value;
+	static const bool exact = true;
+	static const VerifyReduction reduction = VERIFY_SUM;
+
+	static uint64_t zero() { return 0; }
+	static uint64_t add(uint64_t a, uint64_t b) { uint64_t sum = a + b; return sum >= ModularRing::modulus() ? sum - ModularRing::modulus() : sum; }
+	static uint64_t multiply(uint64_t a, uint64_t x) { return ModularRing::reduce(a * x); }
+	template<typename X>
+	static uint64_t from(X value) { return (uint64_t)(uint32_t)value; }
+	static uint64_t random(uint64_t word) { return ModularRing::reduce(word); }
+	static uint64_t reduce(uint64_t value) { return ModularRing::reduce(value); }
+	static bool equal(uint64_t a, uint64_t b, double) { return a == b; }
+};
+
+// real plus-times in double, r uniform in [-1, 1); R is the type of C, whose precision sets the tolerance
+template<typename R>
+struct FloatingVerifier
+{
+	typedef double Value;
+	static const bool exact = false;
+	static const VerifyReduction reduction = VERIFY_SUM;
+
+	static double epsilon() { return std::numeric_limits<R>::epsilon(); }
+	static double zero() { return 0; }
+	static double add(double a, double b) { return a + b; }
+	static double multiply(double a, double x) { return a * x; }
+	template<typename X>
+	static double from(X value) { return (double)value; }
+	static double random(uint64_t word) { return (double)(word >> 11) * (2.0 / 9007199254740992.0) - 1.0; }
+	static double reduce(double value) { return value; }
+	static bool equal(double a, double b, double bound) { return std::fabs(a - b) <= bound; }
+
+	struct Magnitude
+	{
+		typedef double Value;
+		static const VerifyReduction reduction = VERIFY_SUM;
+
+		static double zero() { return 0; }
+		static double add(double a, double b) { return a + b; }
+		static double multiply(double a, double x) { return a * x; }
+		template<typename X>
+		static double from(X value) { return std::fabs((double)value); }
+	};
+};
+
+// min-plus and max-plus: r holds whole numbers below 2^20, so integer weights give exact sums. The magnitude
+// of a sum is the largest magnitude of its terms; infinite terms never decide a finite result and count nothing
+template<bool MAX>
+struct TropicalVerifier
+{
+	typedef double Value;
+	static const bool exact = false;
+	static const VerifyReduction reduction = MAX ? VERIFY_MAX : VERIFY_MIN;
+
+	static double epsilon() { return std::numeric_limits<double>::epsilon(); }
+	static double zero() { return TropicalSemiring<MAX>::zero(); }
+	static double add(double a, double b) { return TropicalSemiring<MAX>::add(a, b); }
+	static double multiply(double a, double x) { return a + x; }
+	template<typename X>
+	static double from(X value) { return (double)value; }
+	static double random(uint64_t word) { return (double)(word >> 44); }
+	static double reduce(double value) { return value; }
+	static bool equal(double a, double b, double bound) { return a == b || (std::isfinite(a) && std::isfinite(b) && std::fabs(a - b) <= bound); }
+
+	struct Magnitude
+	{
+		typedef double Value;
+		static const VerifyReduction reduction = VERIFY_MAX;
+
+		static double zero() { return 0; }
+		static double add(double a, double b) { return std::max(a, b); }
+		static double multiply(double a, double x) { return a + x; }
+		template<typename X>
+		static double from(X value) { return std::isfinite((double)value) ? std::fabs((double)value) : 0; }
+	};
+};
+
+template<typename Ring>
+struct VerifierOf;
+
+template<typename T>
+struct VerifierOf<PlusTimesRing<T>>
+{
+	typedef typename PlusTimesRing<T>::Result Result;
+	typedef typename std::conditional<std::numeric_limits<T>::is_iec559, FloatingVerifier<Result>, IntegerVerifier<Result>>::type type;
+};
+
+template<>
+struct VerifierOf<ModularRing>
+{
+	typedef ModularVerifier type;
+};
+
+template<>
+struct VerifierOf<Wrapping64Ring>
+{
+	typedef IntegerVerifier<long long> type;
+};
+
+template<bool MAX>
+struct VerifierOf<TropicalSemiring<MAX>>
+{
+	typedef TropicalVerifier<MAX> type;
+};
+
+// prototypes
+uint64_t verify_random_word(uint64_t seed, uint64_t index);
+double verify_strassen_growth(int n1, int n2, int n3, int cutoff);
+
+// template prototypes
+template<typename Verifier>
+void fill_verify_vectors(uint64_t seed, int height, int rounds, typename Verifier::Value* r);
+template<typename V, typename X>
+void verify_multiply_add(const Matrix<X>& M, int height, int width, const typename V::Value* x, typename V::Value* y, int rounds, ThreadPool& pool);
+template<typename V, typename T>
+void verify_sparse_multiply_add(const SparseView<T>& M, const typename V::Value* x, typename V::Value* y, int rounds);
+
+// functions
+// splitmix64 of the seed and the index of an element of R, so every rank makes the same R without messages
+inline uint64_t verify_random_word(uint64_t seed, uint64_t index)
+{
+	uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// VERIFY_STRASSEN_GROWTH for every level Strassen-Winograd recurses on an n1 x n2 by n2 x n3 product
+// (halving while every dimension is above cutoff)
+inline double verify_strassen_growth(int n1, int n2, int n3, int cutoff)
+{
+	double growth = 1;
+	for (; std::min(n1, std::min(n2, n3)) > cutoff; n1 /= 2, n2 /= 2, n3 /= 2)
+		growth *= VERIFY_STRASSEN_GROWTH;
+	return growth;
+}
+
+// templates
+// R, height x rounds, row by row
+template<typename Verifier>
+void fill_verify_vectors(uint64_t seed, int height, int rounds, typename Verifier::Value* r)
+{
+	for (size_t e = 0; e < (size_t)height * rounds; e++)
+		r[e] = Verifier::random(verify_random_word(seed, e));
+}
+
+// y += M x in the algebra V, where x (width x rounds) and y (height x rounds) are stored row by row.
+// The threads share blocks of BLOCK_MC rows; a row of M goes by once for all the rounds
+template<typename V, typename X>
+void verify_multiply_add(const Matrix<X>& M, int height, int width, const typename V::Value* x, typename V::Value* y, int rounds, ThreadPool& pool)
+{
+	typedef typename V::Value Value;
+	pool.parallel_for((height + BLOCK_MC - 1) / BLOCK_MC, [&](int task)
+	{
+		for (int i = task * BLOCK_MC; i < std::min(height, (task + 1) * BLOCK_MC); i++)
+		{
+			const X* row = M[i];
+			Value* out = y + (size_t)i * rounds;
+			for (int j = 0; j < width; j++)
+			{
+				Value a = V::from(row[j]);
+				const Value* in = x + (size_t)j * rounds;
+				for (int t = 0; t < rounds; t++)
+					out[t] = V::add(out[t], V::multiply(a, in[t]));
+			}
+		}
+	});
+}
+
+// the same for a packed sparse M; the blocks left out hold the ring's zero and add nothing
+template<typename V, typename T>
+void verify_sparse_multiply_add(const SparseView<T>& M, const typename V::Value* x, typename V::Value* y, int rounds)
+{
+	typedef typename V::Value Value;
+	const int bs = M.blockSize;
+	for (int blockRow = 0; blockRow < M.blockRows; blockRow++)
+	{
+		int startH = blockRow * bs, height = std::min(bs, M.rows - startH);
+		for (int p = M.rowStart[blockRow]; p < M.rowStart[blockRow + 1]; p++)
+		{
+			int startW = M.columns[p] * bs, width = std::min(bs, M.cols - startW);
+			const T* block = M.values + (size_t)p * bs * bs;
+			for (int ii = 0; ii < height; ii++)
+			{
+				Value* out = y + (size_t)(startH + ii) * rounds;
+				for (int jj = 0; jj < width; jj++)
+				{
+					Value a = V::from(block[ii * bs + jj]);
+					const Value* in = x + (size_t)(startW + jj) * rounds;
+					for (int t = 0; t < rounds; t++)
+						out[t] = V::add(out[t], V::multiply(a, in[t]));
+				}
+			}
+		}
+	}
+}
@@ -1,62 +1,377 @@
+#include <cmath>
 #include <fstream>
-#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../Lab4/matrix_format.h"
+#include "../Lab4/text_format.h"
+#include "../Lab4/thread_pool.h"
+#include "philox.h"
 
 using namespace std;
 
+// default shape, the generator takes another one as "Lab4MatrixGenerator n1 n2 n3"
 #define N1 960
 #define N2 768
 #define N3 160
+#define TEXT_EXTENSION ".txt"
+#define DEFAULT_SEED 20240601
+// a thread generates (and formats) about this many elements at a time; a batch gives every thread
+// CHUNKS_PER_THREAD chunks and is written out while the next batch is generated
+#define CHUNK_ELEMENTS (1 << 18)
+#define CHUNKS_PER_THREAD 4
 
-void generate_matrixes();
-void generate_matrix(const char* fileName, int height, int width, bool isDefaultValue, int defaultValue, bool isRandomValue, bool isReal, int randomMin, int randomMax);
+// usage:
+//   Lab4MatrixGenerator [n1 n2 n3] [bin] [seed S] [threads T]         generate the MatrixA*/B* set as text or binary
+//   Lab4MatrixGenerator generate type rows cols output [key value...] generate one matrix, binary when output ends in .bin
+//   Lab4MatrixGenerator convert int|real input output [column]        convert a text matrix to the binary format
+// generate takes the element types of Lab4 (int, real, float, int64, int16, int8) and the keys
+//   dist uniform|normal|constant, min, max (uniform, integers include max), mean, stddev (normal), value (constant),
+//   density (share of elements that aren't 0), decimals (reals are rounded to as many), seed, stream and threads
 
-int main() 
+enum Distribution { DISTRIBUTION_UNIFORM, DISTRIBUTION_NORMAL, DISTRIBUTION_CONSTANT };
+
+// how the elements of one matrix are made. Element (i, j) takes the Philox words of counter i * width + j
+// in the stream, so the contents depend on the seed and stream only, not on the threads or the output format
+struct MatrixSpec
+{
+	int height = 0;
+	int width = 0;
+	Distribution distribution = DISTRIBUTION_UNIFORM;
+	double min = 1;
+	double max = 9;
+	double mean = 0;
+	double stddev = 1;
+	double value = 1;
+	double density = 1;
+	int decimals = -1;
+	uint64_t seed = DEFAULT_SEED;
+	uint64_t stream = 0;
+};
+
+void generate_matrixes(int n1, int n2, int n3, bool isBinary, uint64_t seed, ThreadPool& pool);
+bool generate_matrix(const char* fileName, const string& type, const MatrixSpec& spec, ThreadPool& pool);
+bool parse_generate_options(int argc, char** argv, int first, MatrixSpec& spec, int& threads);
+bool convert_matrix(const char* inputFileName, const char* outputFileName, bool isReal, uint32_t layout);
+template<typename T>
+bool generate_matrix_of(const char* fileName, const MatrixSpec& spec, ThreadPool& pool);
+template<typename T>
+T generate_element(const MatrixSpec& spec, const PhiloxBlock& block);
+template<typename T>
+bool convert_text_matrix(const char* inputFileName, const char* outputFileName, uint32_t layout);
+
+int main(int argc, char** argv)
 {
-	generate_matrixes();
+	if (argc >= 5 && !strcmp(argv[1], "convert"))
+	{
+		bool isReal = !strcmp(argv[2], "real");
+		uint32_t layout = argc >= 6 && !strcmp(argv[5], "column") ? LAYOUT_COLUMN_MAJOR : LAYOUT_ROW_MAJOR;
+		return convert_matrix(argv[3], argv[4], isReal, layout) ? 0 : 1;
+	}
+
+	if (argc >= 6 && !strcmp(argv[1], "generate"))
+	{
+		MatrixSpec spec;
+		int threads = 0;
+		spec.height = atoi(argv[3]);
+		spec.width = atoi(argv[4]);
+		if (spec.height <= 0 || spec.width <= 0 || !parse_generate_options(argc, argv, 6, spec, threads))
+			return 1;
+		ThreadPool pool(threads);
+		return generate_matrix(argv[5], argv[2], spec, pool) ? 0 : 1;
+	}
+
+	bool isBinary = false;
+	uint64_t seed = DEFAULT_SEED;
+	int threads = 0;
+	vector<int> shape;
+	for (int i = 1; i < argc; i++)
+		if (!strcmp(argv[i], "bin"))
+			isBinary = true;
+		else if (!strcmp(argv[i], "seed") && i + 1 < argc)
+			seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else
+			shape.push_back(atoi(argv[i]));
+
+	int n1 = N1, n2 = N2, n3 = N3;
+	if (shape.size() == 3)
+	{
+		n1 = shape[0];
+		n2 = shape[1];
+		n3 = shape[2];
+	}
+	if (n1 <= 0 || n2 <= 0 || n3 <= 0 || (shape.size() != 0 && shape.size() != 3))
+		return 1;
+
+	ThreadPool pool(threads);
+	generate_matrixes(n1, n2, n3, isBinary, seed, pool);
 	return 0;
 }
 
-void generate_matrixes() 
+// every file of the set is a stream of its own under the one seed
+void generate_matrixes(int n1, int n2, int n3, bool isBinary, uint64_t seed, ThreadPool& pool)
+{
+	struct SetFile
+	{
+		const char* name;
+		bool isA;
+		const char* type;
+		Distribution distribution;
+		double min;
+		double max;
+		int decimals;
+	};
+	const SetFile files[] =
+	{
+		{ "MatrixA1", true, "int", DISTRIBUTION_CONSTANT, 1, 1, -1 },
+		{ "MatrixB1", false, "int", DISTRIBUTION_CONSTANT, 1, 1, -1 },
+		{ "MatrixA2", true, "int", DISTRIBUTION_CONSTANT, 1, 1, -1 },
+		{ "MatrixB2", false, "int", DISTRIBUTION_CONSTANT, 3, 3, -1 },
+		{ "MatrixA3", true, "int", DISTRIBUTION_UNIFORM, 1, 9, -1 },
+		{ "MatrixB3", false, "int", DISTRIBUTION_UNIFORM, 1, 9, -1 },
+		{ "MatrixA4", true, "int", DISTRIBUTION_UNIFORM, 10, 108, -1 },
+		{ "MatrixB4", false, "int", DISTRIBUTION_UNIFORM, 10, 108, -1 },
+		{ "MatrixA5", true, "real", DISTRIBUTION_UNIFORM, 100, 10098, 3 },
+		{ "MatrixB5", false, "real", DISTRIBUTION_UNIFORM, 100, 10098, 3 },
+	};
+
+	const char* extension = isBinary ? MATRIX_FILE_EXTENSION : TEXT_EXTENSION;
+	for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+	{
+		MatrixSpec spec;
+		spec.height = files[f].isA ? n1 : n2;
+		spec.width = files[f].isA ? n2 : n3;
+		spec.distribution = files[f].distribution;
+		spec.min = files[f].min;
+		spec.max = files[f].max;
+		spec.value = files[f].min;
+		spec.decimals = files[f].decimals;
+		spec.seed = seed;
+		spec.stream = f;
+		generate_matrix((string(files[f].name) + extension).c_str(), files[f].type, spec, pool);
+	}
+}
+
+bool generate_matrix(const char* fileName, const string& type, const MatrixSpec& spec, ThreadPool& pool)
 {
-	generate_matrix("MatrixA1.txt", N1, N2, true, 1, false, false, NULL, NULL);
-	generate_matrix("MatrixB1.txt", N2, N3, true, 1, false, false, NULL, NULL);
-	generate_matrix("MatrixA2.txt", N1, N2, true, 1, false, false, NULL, NULL);
-	generate_matrix("MatrixB2.txt", N2, N3, true, 3, false, false, NULL, NULL);
-	generate_matrix("MatrixA3.txt", N1, N2, false, NULL, true, false, 1, 9);
-	generate_matrix("MatrixB3.txt", N2, N3, false, NULL, true, false, 1, 9);
-	generate_matrix("MatrixA4.txt", N1, N2, false, NULL, true, false, 10, 99);
-	generate_matrix("MatrixB4.txt", N2, N3, false, NULL, true, false, 10, 99);
-	generate_matrix("MatrixA5.txt", N1, N2, false, NULL, true, true, 100, 9999);
-	generate_matrix("MatrixB5.txt", N2, N3, false, NULL, true, true, 100, 9999);
+	if (type == "int")
+		return generate_matrix_of<int32_t>(fileName, spec, pool);
+	if (type == "real")
+		return generate_matrix_of<double>(fileName, spec, pool);
+	if (type == "float")
+		return generate_matrix_of<float>(fileName, spec, pool);
+	if (type == "int64")
+		return generate_matrix_of<int64_t>(fileName, spec, pool);
+	if (type == "int16")
+		return generate_matrix_of<int16_t>(fileName, spec, pool);
+	if (type == "int8")
+		return generate_matrix_of<int8_t>(fileName, spec, pool);
+	return false;
 }
 
-void generate_matrix(const char* fileName, int height, int width, bool isDefaultValue, int defaultValue, bool isRandomValue, bool isReal, int randomMin, int randomMax)
+// "key value" pairs from argv[first] on
+bool parse_generate_options(int argc, char** argv, int first, MatrixSpec& spec, int& threads)
 {
-	srand(time(NULL));
-	ofstream fout;
-	fout.open(fileName);
-	for (int i = 0; i < height; i++)
+	for (int i = first; i + 1 < argc; i += 2)
 	{
-		for (int j = 0; j < width; j++)
+		string key = argv[i];
+		const char* value = argv[i + 1];
+		if (key == "dist" && !strcmp(value, "uniform"))
+			spec.distribution = DISTRIBUTION_UNIFORM;
+		else if (key == "dist" && !strcmp(value, "normal"))
+			spec.distribution = DISTRIBUTION_NORMAL;
+		else if (key == "dist" && !strcmp(value, "constant"))
+			spec.distribution = DISTRIBUTION_CONSTANT;
+		else if (key == "min")
+			spec.min = atof(value);
+		else if (key == "max")
+			spec.max = atof(value);
+		else if (key == "mean")
+			spec.mean = atof(value);
+		else if (key == "stddev")
+			spec.stddev = atof(value);
+		else if (key == "value")
+			spec.value = atof(value);
+		else if (key == "density")
+			spec.density = atof(value);
+		else if (key == "decimals")
+			spec.decimals = atoi(value);
+		else if (key == "seed")
+			spec.seed = strtoull(value, nullptr, 10);
+		else if (key == "stream")
+			spec.stream = strtoull(value, nullptr, 10);
+		else if (key == "threads")
+			threads = atoi(value);
+		else
+			return false;
+	}
+	return (argc - first) % 2 == 0 && spec.min <= spec.max && spec.density >= 0 && spec.density <= 1;
+}
+
+bool convert_matrix(const char* inputFileName, const char* outputFileName, bool isReal, uint32_t layout)
+{
+	if (isReal)
+		return convert_text_matrix<double>(inputFileName, outputFileName, layout);
+	return convert_text_matrix<int>(inputFileName, outputFileName, layout);
+}
+
+// the matrix is made a batch of rows at a time: the threads of the pool generate the chunks of a batch
+// (and format them for a text file) while the previous batch is written, checksummed for a binary file
+template<typename T>
+bool generate_matrix_of(const char* fileName, const MatrixSpec& spec, ThreadPool& pool)
+{
+	bool isBinary = is_binary_file_name(fileName);
+	ofstream fout(fileName, isBinary ? ios::binary : ios::out);
+	if (!fout)
+		return false;
+	MatrixFileHeader header = make_matrix_file_header<T>(spec.height, spec.width, LAYOUT_ROW_MAJOR);
+	header.flags = MATRIX_FILE_FLAG_CHECKSUM;
+	header.checksum = CHECKSUM_OFFSET_BASIS;
+	if (isBinary)
+		fout.write((const char*)&header, sizeof(header));
+
+	struct Batch
+	{
+		vector<T> values;
+		vector<vector<char>> text;
+		int rows = 0;
+	};
+	int chunkRows = max(1, CHUNK_ELEMENTS / spec.width);
+	int chunks = pool.size() * CHUNKS_PER_THREAD;
+	int batchRows = chunkRows * chunks;
+	Batch batches[2];
+	for (int b = 0; b < 2; b++)
+	{
+		batches[b].values.resize((size_t)min(batchRows, spec.height) * spec.width);
+		batches[b].text.resize(isBinary ? 0 : chunks);
+	}
+
+	future<void> writing;
+	for (int startH = 0, b = 0; startH < spec.height; startH += batchRows, b ^= 1)
+	{
+		// the buffers of this batch were last written two batches ago, which finished before the previous one started writing
+		Batch& batch = batches[b];
+		batch.rows = min(batchRows, spec.height - startH);
+		pool.parallel_for((batch.rows + chunkRows - 1) / chunkRows, [&](int chunk)
+		{
+			int first = chunk * chunkRows, rows = min(chunkRows, batch.rows - first);
+			T* values = batch.values.data() + (size_t)first * spec.width;
+			uint64_t index = (uint64_t)(startH + first) * spec.width;
+			size_t count = (size_t)rows * spec.width;
+			for (size_t e = 0; e < count; e += PHILOX_LANES)
+			{
+				PhiloxBlock blocks[PHILOX_LANES];
+				philox4x32_lanes(index + e, spec.stream, spec.seed, blocks);
+				for (size_t lane = 0; lane < PHILOX_LANES && e + lane < count; lane++)
+					values[e + lane] = generate_element<T>(spec, blocks[lane]);
+			}
+			if (!isBinary)
+			{
+				batch.text[chunk].clear();
+				format_text_rows(values, rows, spec.width, spec.width, startH + first + rows == spec.height, batch.text[chunk]);
+			}
+		});
+
+		if (writing.valid())
+			writing.get();
+		writing = async(launch::async, [&fout, &header, &batch, &spec, chunkRows, isBinary]
 		{
-			if (isDefaultValue)
-				fout << defaultValue;
-			else if (isRandomValue)
-				if (isReal) 
-				{
-					double fraction = (rand() % 1000) / 1000.0;
-					int integer = rand() % (randomMax - 1) + randomMin;
-					fout << integer + fraction;
-				}
-				else
-					fout << rand() % randomMax + randomMin;
-			else
-				fout << 0;
-			if (j != width - 1)
-				fout << " ";
+			if (isBinary)
+			{
+				size_t bytes = (size_t)batch.rows * spec.width * sizeof(T);
+				header.checksum = checksum_bytes(batch.values.data(), bytes, header.checksum);
+				fout.write((const char*)batch.values.data(), bytes);
+				return;
+			}
+			for (int chunk = 0; chunk * chunkRows < batch.rows; chunk++)
+				fout.write(batch.text[chunk].data(), batch.text[chunk].size());
+		});
+	}
+	if (writing.valid())
+		writing.get();
+
+	if (isBinary)
+	{
+		fout.seekp(0);
+		fout.write((const char*)&header, sizeof(header));
+	}
+	return (bool)fout;
+}
+
+// an element from the Philox block of its counter: the first word decides whether it is 0 (density), the others
+// make the value. Integer values are rounded and kept within T; a uniform integer takes any value of [min, max] alike
+template<typename T>
+T generate_element(const MatrixSpec& spec, const PhiloxBlock& block)
+{
+	if (spec.density < 1 && block.word[0] >= spec.density * 4294967296.0)
+		return 0;
+
+	double value;
+	if (spec.distribution == DISTRIBUTION_CONSTANT)
+		value = spec.value;
+	else if (spec.distribution == DISTRIBUTION_NORMAL)
+		value = spec.mean + spec.stddev * sqrt(-2 * log(uniform_open(block.word[1]))) * cos(6.283185307179586 * uniform_double(block.word[2], block.word[3]));
+	else if (is_integral<T>::value)
+		value = floor(spec.min) + floor(uniform_double(block.word[1], block.word[2]) * (floor(spec.max) - floor(spec.min) + 1));
+	else
+		value = spec.min + uniform_double(block.word[1], block.word[2]) * (spec.max - spec.min);
+
+	if (is_integral<T>::value)
+	{
+		value = round(value);
+		value = std::min(std::max(value, (double)numeric_limits<T>::min()), (double)numeric_limits<T>::max());
+	}
+	else if (spec.decimals >= 0)
+	{
+		double scale = pow(10.0, spec.decimals);
+		value = round(value * scale) / scale;
+	}
+	return (T)value;
+}
+
+// reads a text matrix (one row per line) and writes it in the binary format; a column-major
+// output suits B, whose ranks read column slabs
+template<typename T>
+bool convert_text_matrix(const char* inputFileName, const char* outputFileName, uint32_t layout)
+{
+	ifstream fin;
+	fin.open(inputFileName);
+	if (!fin)
+		return false;
+
+	vector<T> values;
+	int height = 0, width = 0;
+	string line;
+	while (getline(fin, line))
+	{
+		size_t rowStart = values.size();
+		const char* cursor = line.c_str();
+		char* end;
+		while (true)
+		{
+			T value = is_floating_point<T>::value ? (T)strtod(cursor, &end) : (T)strtol(cursor, &end, 10);
+			if (end == cursor)
+				break;
+			values.push_back(value);
+			cursor = end;
 		}
-		if (i != height - 1)
-			fout << endl;
+
+		int rowWidth = (int)(values.size() - rowStart);
+		if (rowWidth == 0)
+			continue;
+		if (height == 0)
+			width = rowWidth;
+		else if (rowWidth != width)
+			return false;
+		height++;
 	}
-	fout.close();
-}
\ No newline at end of file
+	fin.close();
+
+	return write_matrix_file(outputFileName, values.data(), height, width, width, layout);
+}
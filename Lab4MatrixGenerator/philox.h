@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"): a counter-based generator
+// that turns a 128-bit counter and a 64-bit key into four random 32-bit words. The generator keys it with
+// the seed and counts elements, so element e of a matrix always gets the same words whichever thread makes
+// it and in whatever order, and every seed and stream gives one fixed matrix
+#define PHILOX_ROUNDS 10
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+// counters philox4x32_lanes works on together
+#define PHILOX_LANES 8
+
+struct PhiloxBlock
+{
+	uint32_t word[4];
+};
+
+// prototypes
+PhiloxBlock philox4x32(uint64_t counter, uint64_t stream, uint64_t seed);
+void philox4x32_lanes(uint64_t counter, uint64_t stream, uint64_t seed, PhiloxBlock* blocks);
+double uniform_double(uint32_t high, uint32_t low);
+double uniform_open(uint32_t word);
+
+// functions
+// counter is the low and stream the high half of the 128-bit counter
+inline PhiloxBlock philox4x32(uint64_t counter, uint64_t stream, uint64_t seed)
+{
+	uint32_t x0 = (uint32_t)counter, x1 = (uint32_t)(counter >> 32), x2 = (uint32_t)stream, x3 = (uint32_t)(stream >> 32);
+	uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+	for (int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		uint64_t product0 = (uint64_t)PHILOX_M0 * x0, product1 = (uint64_t)PHILOX_M1 * x2;
+		uint32_t y0 = (uint32_t)(product1 >> 32) ^ x1 ^ k0, y2 = (uint32_t)(product0 >> 32) ^ x3 ^ k1;
+		x1 = (uint32_t)product1;
+		x3 = (uint32_t)product0;
+		x0 = y0;
+		x2 = y2;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	return { { x0, x1, x2, x3 } };
+}
+
+// the blocks of counters counter ... counter + PHILOX_LANES - 1, the same as philox4x32 gives one by one.
+// The rounds go over all the lanes at once: one block is a chain of dependent multiplies, the lanes
+// are independent, so they fill the pipeline (and vector registers where the compiler manages)
+inline void philox4x32_lanes(uint64_t counter, uint64_t stream, uint64_t seed, PhiloxBlock* blocks)
+{
+	uint32_t x0[PHILOX_LANES], x1[PHILOX_LANES], x2[PHILOX_LANES], x3[PHILOX_LANES];
+	for (int lane = 0; lane < PHILOX_LANES; lane++)
+	{
+		x0[lane] = (uint32_t)(counter + lane);
+		x1[lane] = (uint32_t)((counter + lane) >> 32);
+		x2[lane] = (uint32_t)stream;
+		x3[lane] = (uint32_t)(stream >> 32);
+	}
+	uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+	for (int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		for (int lane = 0; lane < PHILOX_LANES; lane++)
+		{
+			uint64_t product0 = (uint64_t)PHILOX_M0 * x0[lane], product1 = (uint64_t)PHILOX_M1 * x2[lane];
+			uint32_t y0 = (uint32_t)(product1 >> 32) ^ x1[lane] ^ k0, y2 = (uint32_t)(product0 >> 32) ^ x3[lane] ^ k1;
+			x1[lane] = (uint32_t)product1;
+			x3[lane] = (uint32_t)product0;
+			x0[lane] = y0;
+			x2[lane] = y2;
+		}
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	for (int lane = 0; lane < PHILOX_LANES; lane++)
+		blocks[lane] = { { x0[lane], x1[lane], x2[lane], x3[lane] } };
+}
+
+// [0, 1) in steps of 2^-53 from two words
+inline double uniform_double(uint32_t high, uint32_t low)
+{
+	return (double)(((uint64_t)high << 32 | low) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// (0, 1] from one word, for the logarithm of Box-Muller
+inline double uniform_open(uint32_t word)
+{
+	return ((double)word + 1.0) * (1.0 / 4294967296.0);
+}
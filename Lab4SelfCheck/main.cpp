@@ -0,0 +1,486 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../Lab4/narrow.h"
+#include "../Lab4/semiring.h"
+#include "../Lab4/sparse.h"
+#include "../Lab4/stream.h"
+#include "../Lab4/text_format.h"
+#include "../Lab4MatrixGenerator/philox.h"
+
+using namespace std;
+
+// Lab4SelfCheck runs the parts of Lab4 that have one exact answer (round trips of the codecs, the plans that cut
+// a product up) without MPI or files and exits with 1 when any of them fails. A check_* function returns how
+// many of its cases failed and prints each of them
+#define CHECK_SEED 20240601
+// the shape of the matrices the codecs go through, odd so no block or word boundary lines up with an edge
+#define CHECK_ROWS 37
+#define CHECK_COLS 53
+// sparse operands: A is SPARSE_ROWS x SPARSE_DEPTH, B SPARSE_DEPTH x SPARSE_COLS, and a scattered one holds about
+// one element in SPARSE_SCATTER, well below SPARSE_THRESHOLD
+#define SPARSE_ROWS 75
+#define SPARSE_DEPTH 91
+#define SPARSE_COLS 37
+#define SPARSE_SCATTER 60
+#define CHECK_THREADS 2
+// narrow blocks: more rows than one BLOCK_MC task of unpack_narrow, and the width of a row no multiple of a word
+#define NARROW_ROWS 301
+#define NARROW_COLS 37
+
+// prototypes
+int report(bool passed, const string& what);
+int check_text_round_trip();
+int check_sparse();
+int check_stream_plan();
+int check_stream_plan_of(int n1, int n2, int n3, size_t budget, size_t elementSize, int ranks);
+int check_philox();
+int check_narrow();
+bool same_block(const PhiloxBlock& a, const PhiloxBlock& b);
+
+// template prototypes
+template<typename T>
+T random_element(mt19937_64& random);
+template<typename T>
+vector<T> random_elements(mt19937_64& random, size_t count, const vector<T>& special);
+template<typename T>
+bool same_bits(const T* a, const T* b, size_t count);
+template<typename T>
+int check_text_round_trip_of(const char* typeName, mt19937_64& random);
+template<typename T>
+T small_element(mt19937_64& random);
+template<typename T>
+Matrix<T> dense_test_matrix(mt19937_64& random, int rows, int cols);
+template<typename T>
+Matrix<T> sparse_test_matrix(mt19937_64& random, int rows, int cols, T zero, bool clustered);
+template<typename T>
+Matrix<T> unpack_sparse(const SparseView<T>& view, T zero);
+template<typename T>
+bool same_matrix(const Matrix<T>& a, const Matrix<T>& b);
+template<typename Ring, typename T>
+void naive_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C);
+template<typename Ring>
+int check_sparse_of(const char* ringName, mt19937_64& random, ThreadPool& pool);
+template<typename T>
+Matrix<T> narrow_test_matrix(mt19937_64& random, int bits);
+template<typename T>
+int check_narrow_of(const char* typeName, mt19937_64& random, ThreadPool& pool);
+
+int main()
+{
+	int failures = 0;
+	failures += check_text_round_trip();
+	failures += check_sparse();
+	failures += check_stream_plan();
+	failures += check_philox();
+	failures += check_narrow();
+
+	if (failures == 0)
+		cout << "All checks passed." << endl;
+	else
+		cout << failures << " checks failed." << endl;
+	return failures == 0 ? 0 : 1;
+}
+
+// functions
+int report(bool passed, const string& what)
+{
+	if (!passed)
+		cout << "FAILED: " << what << endl;
+	return passed ? 0 : 1;
+}
+
+// to_chars prints the shortest text from_chars reads back to the same bits, for every element type of Lab4
+int check_text_round_trip()
+{
+	mt19937_64 random(CHECK_SEED);
+	int failures = 0;
+	failures += check_text_round_trip_of<double>("real", random);
+	failures += check_text_round_trip_of<float>("float", random);
+	failures += check_text_round_trip_of<int>("int", random);
+	failures += check_text_round_trip_of<long long>("int64", random);
+	failures += check_text_round_trip_of<int16_t>("int16", random);
+	failures += check_text_round_trip_of<int8_t>("int8", random);
+	return failures;
+}
+
+// pack_if_sparse keeps every element of a sparse operand and the three sparse multiplies match a naive one,
+// for a ring whose zero is 0 and one whose zero is +inf
+int check_sparse()
+{
+	mt19937_64 random(CHECK_SEED);
+	ThreadPool pool(CHECK_THREADS);
+	int failures = 0;
+	failures += check_sparse_of<PlusTimesRing<int>>(RING_PLUS_TIMES, random, pool);
+	failures += check_sparse_of<MinPlusSemiring>(RING_MIN_PLUS, random, pool);
+	return failures;
+}
+
+// the steps of all ranks sum every C element over the whole depth exactly once, k tile after k tile, for
+// shapes that do and don't cut into whole tiles, budgets from less than one granule to everything at once
+int check_stream_plan()
+{
+	const int shapes[][3] = { { 1, 1, 1 }, { 64, 64, 64 }, { 100, 70, 130 }, { 1000, 300, 257 }, { 4097, 33, 129 }, { 5, 700, 3 } };
+	const size_t budgets[] = { 1 << 10, 1 << 16, 1 << 20, 1 << 24, (size_t)1 << 32 };
+	const size_t elementSizes[] = { sizeof(int8_t), sizeof(double) };
+	const int rankCounts[] = { 1, 3, 8 };
+	int failures = 0;
+	for (const auto& shape : shapes)
+		for (size_t budget : budgets)
+			for (size_t elementSize : elementSizes)
+				for (int ranks : rankCounts)
+					failures += check_stream_plan_of(shape[0], shape[1], shape[2], budget, elementSize, ranks);
+	return failures;
+}
+
+int check_stream_plan_of(int n1, int n2, int n3, size_t budget, size_t elementSize, int ranks)
+{
+	const size_t resultSize = sizeof(double);
+	StreamPlan plan = plan_stream(n1, n2, n3, budget, elementSize, resultSize);
+	string name = "stream plan " + to_string(n1) + "x" + to_string(n2) + "x" + to_string(n3) + " in " + to_string(budget) + " bytes of "
+		+ to_string(elementSize) + "-byte elements on " + to_string(ranks) + " ranks";
+	int failures = 0;
+	size_t workingSet = stream_working_set(plan.tileH, plan.tileK, plan.tileW, elementSize, resultSize);
+	failures += report(plan.fits == (workingSet <= budget), name + ": fits");
+	failures += report(plan.tileH > 0 && plan.tileH <= n1 && plan.tileK > 0 && plan.tileK <= n2 && plan.tileW > 0 && plan.tileW <= n3, name + ": tile sides");
+
+	// where each C element's next k tile has to start
+	vector<int> nextK((size_t)n1 * n3, 0);
+	bool inBounds = true, inOrder = true;
+	for (int rank = 0; rank < ranks; rank++)
+		for (int step = 0; step < stream_step_count(plan, rank, ranks); step++)
+		{
+			StreamStep tiles = stream_step(plan, rank, ranks, step);
+			inBounds = inBounds && tiles.startH >= 0 && tiles.height > 0 && tiles.startH + tiles.height <= n1
+				&& tiles.startK >= 0 && tiles.depth > 0 && tiles.startK + tiles.depth <= n2
+				&& tiles.startW >= 0 && tiles.width > 0 && tiles.startW + tiles.width <= n3;
+			if (!inBounds)
+				break;
+			for (int i = tiles.startH; i < tiles.startH + tiles.height; i++)
+				for (int j = tiles.startW; j < tiles.startW + tiles.width; j++)
+				{
+					int& next = nextK[(size_t)i * n3 + j];
+					inOrder = inOrder && next == tiles.startK;
+					next += tiles.depth;
+				}
+		}
+	failures += report(inBounds, name + ": steps inside the matrices");
+	failures += report(inOrder && all_of(nextK.begin(), nextK.end(), [n2](int next) { return next == n2; }), name + ": every C tile summed once over the whole depth");
+	return failures;
+}
+
+// philox4x32 gives the known answers of the Random123 reference, and philox4x32_lanes the same blocks as
+// philox4x32 one by one, also where the lanes carry into the high word of the counter or wrap around it
+int check_philox()
+{
+	int failures = 0;
+	const uint64_t ones = numeric_limits<uint64_t>::max();
+	failures += report(same_block(philox4x32(0, 0, 0), { { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } }), "philox known answer of zeros");
+	failures += report(same_block(philox4x32(ones, ones, ones), { { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } }), "philox known answer of ones");
+	failures += report(same_block(philox4x32(0x85a308d3243f6a88ull, 0x0370734413198a2eull, 0x299f31d0a4093822ull), { { 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } }),
+		"philox known answer of pi");
+
+	mt19937_64 random(CHECK_SEED);
+	const uint64_t counters[] = { 0, 1, 0xfffffffcull, ones - 3, ones, random() };
+	const uint64_t streams[] = { 0, 1, ones, random() };
+	const uint64_t seeds[] = { 0, ones, (uint64_t)CHECK_SEED, random() };
+	for (uint64_t counter : counters)
+		for (uint64_t stream : streams)
+			for (uint64_t seed : seeds)
+			{
+				PhiloxBlock blocks[PHILOX_LANES];
+				philox4x32_lanes(counter, stream, seed, blocks);
+				bool same = true;
+				for (int lane = 0; lane < PHILOX_LANES; lane++)
+					same = same && same_block(blocks[lane], philox4x32(counter + lane, stream, seed));
+				failures += report(same, "philox lanes from counter " + to_string(counter) + " of stream " + to_string(stream) + " and seed " + to_string(seed));
+			}
+	return failures;
+}
+
+bool same_block(const PhiloxBlock& a, const PhiloxBlock& b)
+{
+	return memcmp(a.word, b.word, sizeof(a.word)) == 0;
+}
+
+// every width of distance from 0 (all elements equal) to 64 bits packs and unpacks unchanged, and pack_if_narrow
+// turns down what can't go through the packed form or wouldn't get smaller
+int check_narrow()
+{
+	mt19937_64 random(CHECK_SEED);
+	ThreadPool pool(CHECK_THREADS);
+	int failures = 0;
+	failures += check_narrow_of<long long>("int64", random, pool);
+	failures += check_narrow_of<int>("int", random, pool);
+	failures += check_narrow_of<int8_t>("int8", random, pool);
+	failures += check_narrow_of<double>("real", random, pool);
+
+	Matrix<double> real = narrow_test_matrix<double>(random, 4);
+	vector<char> packed;
+	failures += report(pack_if_narrow(real, 1, packed), "narrow real: whole numbers pack");
+	const double rejected[] = { 0.5, -0.0, NARROW_MAX_MAGNITUDE, -NARROW_MAX_MAGNITUDE, numeric_limits<double>::infinity(), numeric_limits<double>::quiet_NaN() };
+	for (double value : rejected)
+	{
+		double kept = real[NARROW_ROWS - 1][NARROW_COLS - 1];
+		real[NARROW_ROWS - 1][NARROW_COLS - 1] = value;
+		failures += report(!pack_if_narrow(real, 1, packed), "narrow real: a block holding " + to_string(value) + " stays dense");
+		real[NARROW_ROWS - 1][NARROW_COLS - 1] = kept;
+	}
+	return failures;
+}
+
+// templates
+// integers over their whole range, reals from random bits (so every exponent and subnormals too), finite only
+template<typename T>
+T random_element(mt19937_64& random)
+{
+	if constexpr (is_integral<T>::value)
+		return (T)random();
+	else
+	{
+		T value;
+		do
+		{
+			uint64_t bits = random();
+			memcpy(&value, &bits, sizeof(value));
+		} while (!isfinite(value));
+		return value;
+	}
+}
+
+// the special values first, then random ones
+template<typename T>
+vector<T> random_elements(mt19937_64& random, size_t count, const vector<T>& special)
+{
+	vector<T> elements(count);
+	for (size_t e = 0; e < count; e++)
+		elements[e] = e < special.size() ? special[e] : random_element<T>(random);
+	return elements;
+}
+
+template<typename T>
+bool same_bits(const T* a, const T* b, size_t count)
+{
+	return memcmp(a, b, count * sizeof(T)) == 0;
+}
+
+// the matrix as text, then all of it and a slab off the corner read back through the row index
+template<typename T>
+int check_text_round_trip_of(const char* typeName, mt19937_64& random)
+{
+	typedef numeric_limits<T> Limits;
+	vector<T> special = { (T)0, (T)1, (T)-1, Limits::min(), Limits::max(), Limits::lowest() };
+	if constexpr (!is_integral<T>::value)
+		special.insert(special.end(), { (T)-0.0, Limits::denorm_min(), -Limits::denorm_min(), (T)0.1, (T)1 / (T)3, Limits::epsilon() });
+	vector<T> matrix = random_elements<T>(random, (size_t)CHECK_ROWS * CHECK_COLS, special);
+
+	vector<char> text;
+	format_text_rows(matrix.data(), CHECK_ROWS, CHECK_COLS, CHECK_COLS, true, text);
+	TextRowIndex index;
+	int rows = build_text_row_index(text.data(), text.size(), -1, index);
+
+	vector<T> whole((size_t)CHECK_ROWS * CHECK_COLS), slab((size_t)CHECK_ROWS * CHECK_COLS);
+	bool read = read_text_rows(index, whole.data(), CHECK_COLS, 0, CHECK_ROWS, 0, CHECK_COLS);
+	int startH = CHECK_ROWS / 3, startW = CHECK_COLS / 2, height = CHECK_ROWS - startH, width = CHECK_COLS - startW;
+	bool readSlab = read_text_rows(index, slab.data(), width, startH, height, startW, width);
+	bool slabSame = readSlab;
+	for (int i = 0; i < height && slabSame; i++)
+		slabSame = same_bits(slab.data() + (size_t)i * width, matrix.data() + (size_t)(startH + i) * CHECK_COLS + startW, width);
+
+	string name = string("text round trip of ") + typeName;
+	int failures = 0;
+	failures += report(rows == CHECK_ROWS, name + ": row count");
+	failures += report(read && same_bits(whole.data(), matrix.data(), matrix.size()), name + ": whole matrix");
+	failures += report(slabSame, name + ": slab");
+	failures += report(!read_text_rows(index, slab.data(), CHECK_COLS, 1, CHECK_ROWS, 0, CHECK_COLS), name + ": rows past the end are refused");
+	return failures;
+}
+
+// a whole number in [-9, 9] other than 0, so every sum of products is exact in any element type
+template<typename T>
+T small_element(mt19937_64& random)
+{
+	T value = (T)(1 + random() % 9);
+	return random() % 2 ? value : -value;
+}
+
+template<typename T>
+Matrix<T> dense_test_matrix(mt19937_64& random, int rows, int cols)
+{
+	Matrix<T> matrix(rows, cols);
+	for (int i = 0; i < rows; i++)
+		for (int j = 0; j < cols; j++)
+			matrix[i][j] = small_element<T>(random);
+	return matrix;
+}
+
+// scattered elements go CSR; clustered ones fill one inner block and the block cut at the bottom right edge,
+// so they go SPARSE_BLOCK blocks
+template<typename T>
+Matrix<T> sparse_test_matrix(mt19937_64& random, int rows, int cols, T zero, bool clustered)
+{
+	Matrix<T> matrix(rows, cols);
+	int edgeH = (rows - 1) / SPARSE_BLOCK * SPARSE_BLOCK, edgeW = (cols - 1) / SPARSE_BLOCK * SPARSE_BLOCK;
+	for (int i = 0; i < rows; i++)
+		for (int j = 0; j < cols; j++)
+		{
+			bool kept;
+			if (clustered)
+				kept = (i / SPARSE_BLOCK == 1 && j / SPARSE_BLOCK == 2) || (i >= edgeH && j >= edgeW);
+			else
+				kept = random() % SPARSE_SCATTER == 0;
+			matrix[i][j] = kept ? small_element<T>(random) : zero;
+		}
+	return matrix;
+}
+
+template<typename T>
+Matrix<T> unpack_sparse(const SparseView<T>& view, T zero)
+{
+	Matrix<T> matrix(view.rows, view.cols);
+	for (int i = 0; i < view.rows; i++)
+		for (int j = 0; j < view.cols; j++)
+			matrix[i][j] = zero;
+	for (int blockRow = 0; blockRow < view.blockRows; blockRow++)
+		for (int p = view.rowStart[blockRow]; p < view.rowStart[blockRow + 1]; p++)
+		{
+			int startH = blockRow * view.blockSize, startW = view.columns[p] * view.blockSize;
+			const T* block = view.values + (size_t)p * view.blockSize * view.blockSize;
+			for (int ii = 0; ii < view.blockSize && startH + ii < view.rows; ii++)
+				for (int jj = 0; jj < view.blockSize && startW + jj < view.cols; jj++)
+					matrix[startH + ii][startW + jj] = block[ii * view.blockSize + jj];
+		}
+	return matrix;
+}
+
+template<typename T>
+bool same_matrix(const Matrix<T>& a, const Matrix<T>& b)
+{
+	if (a.height() != b.height() || a.width() != b.width())
+		return false;
+	for (int i = 0; i < a.height(); i++)
+		if (!same_bits(a[i], b[i], a.width()))
+			return false;
+	return true;
+}
+
+template<typename Ring, typename T>
+void naive_multiply(const Matrix<T>& A, const Matrix<T>& B, Matrix<typename Ring::Result>& C)
+{
+	for (int i = 0; i < A.height(); i++)
+		for (int j = 0; j < B.width(); j++)
+		{
+			typename Ring::Accumulator accumulator = (typename Ring::Accumulator)Ring::zero();
+			for (int k = 0; k < A.width(); k++)
+				accumulator = Ring::multiply_add(accumulator, A[i][k], B[k][j]);
+			C[i][j] = Ring::accumulate(Ring::zero(), accumulator);
+		}
+}
+
+template<typename Ring>
+int check_sparse_of(const char* ringName, mt19937_64& random, ThreadPool& pool)
+{
+	typedef typename Ring::Element T;
+	typedef typename Ring::Result Result;
+	const T zero = (T)Ring::zero();
+	string name = string("sparse ") + ringName;
+	int failures = 0;
+
+	Matrix<T> denseA = dense_test_matrix<T>(random, SPARSE_ROWS, SPARSE_DEPTH);
+	Matrix<T> denseB = dense_test_matrix<T>(random, SPARSE_DEPTH, SPARSE_COLS);
+	vector<char> packedA, packedB;
+	failures += report(!pack_if_sparse<Ring>(denseA, SPARSE_THRESHOLD, packedA), name + ": a dense operand stays dense");
+	failures += report(!pack_if_sparse<Ring>(sparse_test_matrix<T>(random, SPARSE_ROWS, SPARSE_DEPTH, zero, false), -1, packedA), name + ": a negative threshold keeps it dense");
+
+	Matrix<Result> expected(SPARSE_ROWS, SPARSE_COLS), C(SPARSE_ROWS, SPARSE_COLS);
+	for (int layoutA = 0; layoutA < 2; layoutA++)
+		for (int layoutB = 0; layoutB < 2; layoutB++)
+		{
+			string layouts = name + (layoutA ? " blocks" : " CSR") + " x" + (layoutB ? " blocks" : " CSR");
+			Matrix<T> A = sparse_test_matrix<T>(random, SPARSE_ROWS, SPARSE_DEPTH, zero, layoutA);
+			Matrix<T> B = sparse_test_matrix<T>(random, SPARSE_DEPTH, SPARSE_COLS, zero, layoutB);
+			bool sparseA = pack_if_sparse<Ring>(A, SPARSE_THRESHOLD, packedA);
+			bool sparseB = pack_if_sparse<Ring>(B, SPARSE_THRESHOLD, packedB);
+			failures += report(sparseA && sparseB, layouts + ": operands go sparse");
+			if (!sparseA || !sparseB)
+				continue;
+			SparseView<T> viewA = sparse_view<T>(packedA.data()), viewB = sparse_view<T>(packedB.data());
+			failures += report(viewA.blockSize == (layoutA ? SPARSE_BLOCK : 1) && viewB.blockSize == (layoutB ? SPARSE_BLOCK : 1), layouts + ": layout");
+			failures += report(same_matrix(unpack_sparse(viewA, zero), A) && same_matrix(unpack_sparse(viewB, zero), B), layouts + ": pack round trip");
+
+			naive_multiply<Ring>(A, denseB, expected);
+			sparse_dense_multiply<Ring>(viewA, denseB, C, SPARSE_COLS, pool);
+			failures += report(same_matrix(C, expected), layouts + ": sparse x dense");
+			naive_multiply<Ring>(denseA, B, expected);
+			dense_sparse_multiply<Ring>(denseA, viewB, C, SPARSE_ROWS, SPARSE_DEPTH, pool);
+			failures += report(same_matrix(C, expected), layouts + ": dense x sparse");
+			naive_multiply<Ring>(A, B, expected);
+			sparse_sparse_multiply<Ring>(viewA, viewB, C, pool);
+			failures += report(same_matrix(C, expected), layouts + ": sparse x sparse");
+		}
+	return failures;
+}
+
+// elements base .. base + 2^bits - 1 around 0, both ends present, so narrow_range finds exactly bits
+template<typename T>
+Matrix<T> narrow_test_matrix(mt19937_64& random, int bits)
+{
+	uint64_t range = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+	int64_t base = (int64_t)(0 - (range / 2 + 1));
+	Matrix<T> matrix(NARROW_ROWS, NARROW_COLS);
+	for (int i = 0; i < NARROW_ROWS; i++)
+		for (int j = 0; j < NARROW_COLS; j++)
+		{
+			uint64_t distance = i == 0 && j == 0 ? 0 : i == 0 && j == 1 ? range : random() & range;
+			matrix[i][j] = (T)(int64_t)((uint64_t)base + distance);
+		}
+	return matrix;
+}
+
+template<typename T>
+int check_narrow_of(const char* typeName, mt19937_64& random, ThreadPool& pool)
+{
+	const int maxBits = is_integral<T>::value ? (int)sizeof(T) * 8 : numeric_limits<T>::digits;
+	const T outside = (T)42;
+	string name = string("narrow ") + typeName;
+	int failures = 0;
+	for (int bits : { 0, 1, 3, 7, 8, 13, 31, 32, 53, 63, 64 })
+	{
+		if (bits > maxBits)
+			continue;
+		string width = name + " of " + to_string(bits) + " bits";
+		Matrix<T> matrix = narrow_test_matrix<T>(random, bits);
+		int64_t base;
+		int foundBits;
+		bool ranged = narrow_range(matrix, base, foundBits);
+		failures += report(ranged && foundBits == bits && base == (int64_t)matrix[0][0], width + ": range");
+		if (!ranged)
+			continue;
+
+		vector<char> packed(narrow_packed_size(NARROW_ROWS, NARROW_COLS, foundBits));
+		pack_narrow(matrix, base, foundBits, packed.data());
+		// into the corner of a larger matrix, which has to keep the elements around it
+		Matrix<T> unpacked(NARROW_ROWS + 2, NARROW_COLS + 3);
+		for (int i = 0; i < unpacked.height(); i++)
+			for (int j = 0; j < unpacked.width(); j++)
+				unpacked[i][j] = outside;
+		unpack_narrow(packed.data(), unpacked, pool);
+		bool same = true;
+		for (int i = 0; i < unpacked.height(); i++)
+			for (int j = 0; j < unpacked.width(); j++)
+				same = same && (i < NARROW_ROWS && j < NARROW_COLS ? same_bits(&unpacked[i][j], &matrix[i][j], 1) : unpacked[i][j] == outside);
+		failures += report(same, width + ": round trip");
+
+		bool smaller = packed.size() <= matrix.size() * sizeof(T);
+		failures += report(pack_if_narrow(matrix, 1, packed) == smaller, width + ": packed only when smaller");
+		failures += report(!pack_if_narrow(matrix, -1, packed), width + ": a negative ratio keeps it dense");
+	}
+	return failures;
+}